@@ -24,6 +24,8 @@ typedef __uint128_t ubn_extunit_t;
 #define UBN_LTEN 10000000000000000u  // 10 ** 16
 #define UBN_LTEN_EXP 16
 #define UBN_LTEN_BIT 54
+#define UBN_DEC_BASE 10000000000000000000u  // 10 ** 19
+#define UBN_DEC_EXP 19
 #else
 #define CPU64 0
 typedef uint32_t ubn_unit_t;
@@ -33,8 +35,16 @@ typedef uint64_t ubn_extunit_t;
 #define UBN_LTEN 100000000u  // 10 ** 8
 #define UBN_LTEN_EXP 8
 #define UBN_LTEN_BIT 27
+#define UBN_DEC_BASE 1000000000u  // 10 ** 9
+#define UBN_DEC_EXP 9
 #endif
 
+/* limbs of ubn_red_t keep this many bits, the rest of the unit is headroom
+ * for the sums whose carries are not propagated yet
+ */
+#define UBN_RED_BIT (UBN_UNIT_BIT - 8)
+#define UBN_RED_MASK ((((ubn_unit_t) 1) << UBN_RED_BIT) - 1)
+
 #define UBN_SUPERTEN_EXP 1024
 #define UBN_ULTRATEN_EXP 65536
 
@@ -3,6 +3,7 @@
 #include <time.h>
 #include "base.h"
 #include "ubignum.h"
+#include "ubn_limb.h"
 
 #define FIBSE 0
 #define FAST 1
@@ -15,12 +16,13 @@ static inline void ubignum_show(const ubn_t *N)
     free(s);
 }
 
-static ubn_t *fib_sequence(uint32_t k);
-static ubn_t *fib_fast(uint32_t k);
+static ubn_t *fib_sequence(uint64_t k);
+static ubn_t *fib_fast(uint64_t k);
 
 int main()
 {
     const int target = 1000000;
+    ubn_limb_init();
 #if FIBSE
     ubn_t *fib[2] = {NULL, NULL};
     fib[0] = ubignum_init(UBN_DEFAULT_CAPACITY);
@@ -77,7 +79,7 @@ int main()
 
 
 
-static ubn_t *fib_fast(uint32_t k)
+static ubn_t *fib_fast(uint64_t k)
 {
     ubn_t *fast[5];
     if (k == 0) {
@@ -94,19 +96,19 @@ static ubn_t *fib_fast(uint32_t k)
         fast[i] = ubignum_init(UBN_DEFAULT_CAPACITY);
     ubignum_set_zero(fast[1]);
     ubignum_set_u64(fast[2], 1);
-    int n = 1;
-    for (int currbit = 1 << (32 - __builtin_clzll(k) - 1 - 1); currbit;
-         currbit = currbit >> 1) {
+    uint64_t n = 1;
+    for (uint64_t currbit = (uint64_t) 1 << (64 - __builtin_clzll(k) - 1 - 1);
+         currbit; currbit = currbit >> 1) {
         /* compute 2n-1 */
-        ubignum_square(fast[1], &fast[0]);
-        ubignum_square(fast[2], &fast[3]);
+        ubignum_square(fast[1], &fast[0], NULL);
+        ubignum_square(fast[2], &fast[3], NULL);
         // ubignum_mult(fast[1], fast[1], &fast[0]);
         // ubignum_mult(fast[2], fast[2], &fast[3]);
         ubignum_add(fast[0], fast[3], &fast[3]);
         /* compute 2n */
         ubignum_left_shift(fast[1], 1, &fast[4]);
         ubignum_add(fast[4], fast[2], &fast[4]);
-        ubignum_mult(fast[4], fast[2], &fast[4]);
+        ubignum_mult(fast[4], fast[2], &fast[4], NULL);
         n *= 2;
         if (k & currbit) {
             ubignum_add(fast[3], fast[4], &fast[0]);
@@ -126,7 +128,7 @@ end:;
     return fast[2];
 }
 
-static ubn_t *fib_sequence(uint32_t k)
+static ubn_t *fib_sequence(uint64_t k)
 {
     ubn_t *fib[2];
     fib[0] = ubignum_init(UBN_DEFAULT_CAPACITY);
@@ -134,7 +136,7 @@ static ubn_t *fib_sequence(uint32_t k)
     fib[1] = ubignum_init(UBN_DEFAULT_CAPACITY);
     ubignum_set_u64(fib[1], 1);
 
-    for (int i = 2; i <= k; i++)
+    for (uint64_t i = 2; i <= k; i++)
         ubignum_add(fib[0], fib[1], &fib[i & 1]);
     ubignum_free(fib[(k & 1) ^ 1]);
     return fib[k & 1];
@@ -0,0 +1,333 @@
+#include "fib_engine.h"
+#include "base.h"
+#include "ubignum.h"
+
+#if KSPACE
+#include <linux/completion.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+#else
+#include <pthread.h>
+#include <stdio.h>
+#include "list.h"
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define KERN_INFO ""
+#define READ_ONCE(x) (*(volatile typeof(x) *) &(x))
+#define WRITE_ONCE(x, v) (*(volatile typeof(x) *) &(x) = (v))
+#define cond_resched() \
+    do {               \
+    } while (0)
+#endif
+
+unsigned int fib_par_limbs = 256;
+
+/* additions between two checks of the request in fib_sequence() */
+#define FIB_SEQ_STRIDE 4096
+
+/* F(k) by adding up the sequence */
+ubn_t *fib_sequence(uint64_t k, struct fib_ctx *ctx)
+{
+    ubn_t *fib[2];
+    bool flag = true;
+    /* allocate the final capacity at once, so ubignum_add() never recaps */
+    fib[0] = ubignum_init(fib_capacity(k));
+    fib[1] = ubignum_init(fib_capacity(k));
+    if (unlikely(!fib[0] || !fib[1])) {
+        ubignum_free(fib[0]);
+        ubignum_free(fib[1]);
+        return NULL;
+    }
+    ubignum_set_u64(fib[1], 1);
+
+    for (uint64_t i = 2; i <= k; i++) {
+        if (unlikely(!(i % FIB_SEQ_STRIDE)) &&
+            !fib_check(ctx, (uint64_t) FIB_SEQ_STRIDE * fib[1]->size)) {
+            ubignum_free(fib[0]);
+            ubignum_free(fib[1]);
+            return NULL;
+        }
+        flag &= ubignum_add(fib[0], fib[1], &fib[i & 1]);
+    }
+    ubignum_free(fib[(k & 1) ^ 1]);
+    if (unlikely(!flag))
+        printk(KERN_INFO "@flag in fib_sequence() reported false\n");
+    return fib[k & 1];
+}
+
+/* Same as fib_sequence() in base UBN_DEC_BASE, so the result needs no
+ * conversion to be printed.
+ */
+ubn_dec_t *fib_sequence_dec(uint64_t k, struct fib_ctx *ctx)
+{
+    ubn_dec_t *fib[2];
+    const uint32_t capacity = fib_digits(k) / UBN_DEC_EXP + 2;
+    bool flag = true;
+    fib[0] = ubn_dec_init(capacity);
+    fib[1] = ubn_dec_init(capacity);
+    if (unlikely(!fib[0] || !fib[1])) {
+        ubn_dec_free(fib[0]);
+        ubn_dec_free(fib[1]);
+        return NULL;
+    }
+    ubn_dec_set(fib[1], 1);
+
+    for (uint64_t i = 2; i <= k; i++) {
+        if (unlikely(!(i % FIB_SEQ_STRIDE)) &&
+            !fib_check(ctx, (uint64_t) FIB_SEQ_STRIDE * fib[1]->size)) {
+            ubn_dec_free(fib[0]);
+            ubn_dec_free(fib[1]);
+            return NULL;
+        }
+        flag &= ubn_dec_add(fib[0], fib[1], fib[i & 1]);
+    }
+    ubn_dec_free(fib[(k & 1) ^ 1]);
+    if (unlikely(!flag))
+        printk(KERN_INFO "@flag in fib_sequence_dec() reported false\n");
+    return fib[k & 1];
+}
+
+/* Additions between two steps of fib_sequence_red() that move the carries.
+ * Right after those two steps, both numbers have limbs below about
+ * 2 ** UBN_RED_BIT. The limbs then grow like the sequence, and the sum taken
+ * by the first carrying step is below F(FIB_RED_STEPS + 1) times that, which
+ * has to stay within the 8 bits of headroom.
+ */
+#define FIB_RED_STEPS 8
+
+/* Same as fib_sequence() on ubn_red_t, the carries are moved only by the
+ * last two additions of every FIB_RED_STEPS.
+ */
+ubn_t *fib_sequence_red(uint64_t k, struct fib_ctx *ctx)
+{
+    ubn_red_t *fib[2];
+    ubn_t *N = NULL;
+    const uint32_t capacity =
+        (fib_limbs(k) * UBN_UNIT_BIT + UBN_RED_BIT - 1) / UBN_RED_BIT + 2;
+    bool flag = true;
+    fib[0] = ubn_red_init(capacity);
+    fib[1] = ubn_red_init(capacity);
+    if (unlikely(!fib[0] || !fib[1]))
+        goto out;
+    ubn_red_set(fib[1], 1);
+
+    for (uint64_t i = 2; i <= k; i++) {
+        if (unlikely(!(i % FIB_SEQ_STRIDE)) &&
+            !fib_check(ctx, (uint64_t) FIB_SEQ_STRIDE * fib[1]->size))
+            goto out;
+        flag &= ubn_red_add(fib[i & 1], fib[(i & 1) ^ 1],
+                            i % FIB_RED_STEPS >= FIB_RED_STEPS - 2);
+    }
+    if (unlikely(!flag))
+        printk(KERN_INFO "@flag in fib_sequence_red() reported false\n");
+    N = ubignum_init(fib_capacity(k));
+    if (unlikely(N && !ubn_red_2ubn(fib[k & 1], N))) {
+        ubignum_free(N);
+        N = NULL;
+    }
+out:
+    ubn_red_free(fib[0]);
+    ubn_red_free(fib[1]);
+    return N;
+}
+
+/* The hooks the products of fib_fast() call between their rows, so a request
+ * is checked within UBN_POLL_WORK chunk operations even when one step takes
+ * seconds. Only the caller charges @ctx, the workers of a parallel step stop
+ * once it has given up.
+ */
+struct fib_poll {
+    ubn_poll_t poll;
+    ubn_poll_t worker;
+    struct fib_ctx *ctx;
+    bool stop;
+};
+
+static bool fib_poll_caller(ubn_poll_t *p)
+{
+    struct fib_poll *fp = container_of(p, struct fib_poll, poll);
+    if (likely(fib_check(fp->ctx, 0)))
+        return true;
+    WRITE_ONCE(fp->stop, true);
+    return false;
+}
+
+static bool fib_poll_worker(ubn_poll_t *p)
+{
+    cond_resched();
+    return !READ_ONCE(container_of(p, struct fib_poll, worker)->stop);
+}
+
+/* a square computed by a worker for fib_fast() */
+struct fib_sqr {
+#if KSPACE
+    struct work_struct work;
+    struct completion done;
+#else
+    pthread_t thread;
+    bool threaded;
+#endif
+    ubn_t *a;
+    ubn_t **out;
+    ubn_poll_t *poll;
+    bool ok;
+};
+
+#if KSPACE
+static void fib_sqr_work(struct work_struct *work)
+{
+    struct fib_sqr *sq = container_of(work, struct fib_sqr, work);
+    sq->ok = ubignum_square(sq->a, sq->out, sq->poll);
+    complete(&sq->done);
+}
+
+static void fib_sqr_start(struct fib_sqr *sq)
+{
+    INIT_WORK_ONSTACK(&sq->work, fib_sqr_work);
+    init_completion(&sq->done);
+    queue_work(system_unbound_wq, &sq->work);
+}
+
+static bool fib_sqr_wait(struct fib_sqr *sq)
+{
+    wait_for_completion(&sq->done);
+    destroy_work_on_stack(&sq->work);
+    return sq->ok;
+}
+#else
+static void *fib_sqr_thread(void *arg)
+{
+    struct fib_sqr *sq = arg;
+    sq->ok = ubignum_square(sq->a, sq->out, sq->poll);
+    return NULL;
+}
+
+/* without a thread, the square is computed right away */
+static void fib_sqr_start(struct fib_sqr *sq)
+{
+    sq->threaded = !pthread_create(&sq->thread, NULL, fib_sqr_thread, sq);
+    if (!sq->threaded)
+        fib_sqr_thread(sq);
+}
+
+static bool fib_sqr_wait(struct fib_sqr *sq)
+{
+    if (sq->threaded)
+        pthread_join(sq->thread, NULL);
+    return sq->ok;
+}
+#endif
+
+/* Advance @p by fast doubling, see fib_engine.h.
+ * If @parallel, the three products of each doubling step of at least
+ * @fib_par_limbs chunks run at once: F(n - 1) ** 2 and F(n) ** 2 on two workers
+ * and F(n) * (2 * F(n - 1) + F(n)) in the caller. The steps themselves form
+ * a chain, and splitting k into m + n to use F(m + n) = F(m) F(n + 1) +
+ * F(m - 1) F(n) doesn't break it: F(m) and F(n) take nearly the whole ladder
+ * each, and the combination costs as much as the last step of the ladder.
+ */
+bool fib_fast_pair(uint64_t k,
+                   struct fib_pair *p,
+                   struct fib_ctx *ctx,
+                   bool parallel)
+{
+    /* fast[1] and fast[2] hold F(n - 1) and F(n), fast[5] and fast[6] the
+     * squares of the parallel steps
+     */
+    ubn_t *fast[7] = {NULL};
+    const int count = parallel ? 7 : 5;
+    bool flag = true;
+    struct fib_poll fp = {
+        .poll = {.fn = fib_poll_caller},
+        .worker = {.fn = fib_poll_worker},
+        .ctx = ctx,
+    };
+    ubn_poll_t *poll = ctx ? &fp.poll : NULL;
+
+    /* Every number gets the final capacity once, then neither
+     * ubignum_recap() nor reallocating the products happens in the ladder.
+     */
+    for (int i = 0; i < count; i++) {
+        if (p->n && (i == 1 || i == 2)) {
+            fast[i] = p->f[i - 1];
+            continue;
+        }
+        fast[i] = ubignum_init(fib_capacity(k));
+        if (unlikely(!fast[i]))
+            goto fail;
+    }
+    if (!p->n) {
+        ubignum_set_zero(fast[1]);
+        ubignum_set_u64(fast[2], 1);
+        p->n = 1;
+    }
+    /* the bits of k below those of n */
+    const int shift = __builtin_clzll(p->n) - __builtin_clzll(k);
+    for (uint64_t currbit = shift ? (uint64_t) 1 << (shift - 1) : 0; currbit;
+         currbit = currbit >> 1) {
+        /* the step takes three products of about this size */
+        const uint64_t size = fast[2]->size;
+        if (unlikely(!fib_check(ctx, 3 * size * size)))
+            goto fail;
+        if (parallel && size >= READ_ONCE(fib_par_limbs)) {
+            struct fib_sqr sq[2] = {
+                {.a = fast[1], .out = &fast[5], .poll = &fp.worker},
+                {.a = fast[2], .out = &fast[6], .poll = &fp.worker},
+            };
+            for (int i = 0; i < 2; i++)
+                fib_sqr_start(&sq[i]);
+            flag &= ubignum_dbl_add(fast[1], fast[2], &fast[4]);
+            flag &= ubignum_mult(fast[4], fast[2], &fast[0], poll);
+            for (int i = 0; i < 2; i++)
+                flag &= fib_sqr_wait(&sq[i]);
+            flag &= ubignum_add(fast[5], fast[6], &fast[3]);
+        } else {
+            /* compute 2n-1 */
+            flag &= ubignum_square_sum(fast[1], fast[2], &fast[3], poll);
+            /* compute 2n, the product goes to fast[0] to avoid aliasing */
+            flag &= ubignum_dbl_add(fast[1], fast[2], &fast[4]);
+            flag &= ubignum_mult(fast[4], fast[2], &fast[0], poll);
+        }
+        if (k & currbit) {
+            flag &= ubignum_add(fast[3], fast[0], &fast[4]);
+            ubignum_swapptr(&fast[2], &fast[4]);
+            ubignum_swapptr(&fast[1], &fast[0]);
+        } else {
+            ubignum_swapptr(&fast[2], &fast[0]);
+            ubignum_swapptr(&fast[1], &fast[3]);
+        }
+    }
+    if (unlikely(!flag)) {
+        /* a request given up in a product is no failure to report */
+        if (fib_check(ctx, 0))
+            printk(KERN_INFO "@flag in fib_fast() reported false\n");
+        goto fail;
+    }
+    ubignum_free(fast[0]);
+    for (int i = 3; i < count; i++)
+        ubignum_free(fast[i]);
+    p->n = k;
+    p->f[0] = fast[1];
+    p->f[1] = fast[2];
+    return true;
+fail:
+    for (int i = 0; i < count; i++)
+        ubignum_free(fast[i]);
+    p->f[0] = p->f[1] = NULL;
+    return false;
+}
+
+ubn_t *fib_fast(uint64_t k, struct fib_ctx *ctx, bool parallel)
+{
+    if (k == 0) {
+        ubn_t *N = ubignum_init(UBN_DEFAULT_CAPACITY);
+        if (N)
+            ubignum_set_zero(N);
+        return N;
+    }
+    struct fib_pair p = {.n = 0};
+    if (unlikely(!fib_fast_pair(k, &p, ctx, parallel)))
+        return NULL;
+    ubignum_free(p.f[0]);
+    return p.f[1];
+}
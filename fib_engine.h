@@ -0,0 +1,83 @@
+#ifndef __FIB_ENGINE_H
+#define __FIB_ENGINE_H
+
+/* the engines computing F(k), shared by the driver and libubignum */
+
+#include "base.h"
+#include "ubignum.h"
+
+#if KSPACE
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+/* log_2(phi) and log_10(phi) in 32-bit fixed point, rounded up */
+#define FIB_LOG2_PHI 2981746315u
+#define FIB_LOG10_PHI 897595081u
+
+/* x * (c / 2 ** 32) rounded down, without 128-bit arithmetic */
+static inline uint64_t fib_fixmul(uint64_t x, uint32_t c)
+{
+    return (x >> 32) * c + (((x & 0xFFFFFFFFu) * c) >> 32);
+}
+
+/* upper bound of the number of chunks F(k) occupies
+ * F(k) <= phi ** (k - 1), so it has at most k * log_2(phi) + 1 bits.
+ */
+static inline uint64_t fib_limbs(uint64_t k)
+{
+    return (fib_fixmul(k, FIB_LOG2_PHI) + 1) / UBN_UNIT_BIT + 1;
+}
+
+/* capacity that holds every intermediate number of the engines for F(k)
+ * ubignum_mult() wants a->size + b->size chunks, which may exceed the size of
+ * the product by one, and ubignum_square_sum() wants one more for the carry.
+ */
+static inline uint32_t fib_capacity(uint64_t k)
+{
+    return fib_limbs(k) + 2;
+}
+
+/* upper bound of the number of decimal digits of F(k) */
+static inline uint64_t fib_digits(uint64_t k)
+{
+    return fib_fixmul(k, FIB_LOG10_PHI) + 1;
+}
+
+/* state of a request, known only to the user of the engines */
+struct fib_ctx;
+
+/* Charge @work chunk operations to the request and tell whether it may go on.
+ * The engines call it every so often. It is provided by the user of the
+ * engines, and has to accept a NULL @ctx.
+ */
+bool fib_check(struct fib_ctx *ctx, uint64_t work);
+
+/* steps of fib_fast() of at least this many chunks may run in parallel */
+extern unsigned int fib_par_limbs;
+
+/* F(k), NULL on allocation failure or when fib_check() gives up */
+ubn_t *fib_sequence(uint64_t k, struct fib_ctx *ctx);
+ubn_dec_t *fib_sequence_dec(uint64_t k, struct fib_ctx *ctx);
+ubn_t *fib_sequence_red(uint64_t k, struct fib_ctx *ctx);
+ubn_t *fib_fast(uint64_t k, struct fib_ctx *ctx, bool parallel);
+
+/* F(n - 1) and F(n), where fib_fast_pair() starts and stops */
+struct fib_pair {
+    uint64_t n;
+    ubn_t *f[2];
+};
+
+/* Move @p from n to k >= 1 by fast doubling, n being a prefix of the bits of
+ * k, that is k >> j for some j, or 0 to start from scratch, then @f is
+ * allocated. Otherwise @f is taken over and has to hold fib_capacity(k)
+ * chunks. On failure @f is freed and false returned.
+ */
+bool fib_fast_pair(uint64_t k,
+                   struct fib_pair *p,
+                   struct fib_ctx *ctx,
+                   bool parallel);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __FIB_IOCTL_H
+#define __FIB_IOCTL_H
+
+/* ioctl interface of /dev/fibonacci, shared by the driver and user space */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define FIB_IOC_MAGIC 'f'
+
+/* engines, write() times the one given as its size */
+#define FIB_ENGINE_SEQUENCE 0
+#define FIB_ENGINE_FAST 1
+#define FIB_ENGINE_PARALLEL 2
+#define FIB_ENGINE_DECIMAL 3  // the sequence in decimal limbs
+#define FIB_ENGINE_CARRY_SAVE 4  // the sequence with delayed carries
+#define FIB_ENGINE_MAX 5
+
+/* F(k) mod m
+ * @k: index, any 64-bit value
+ * @m: modulus, must not be 0
+ * @result: filled by the driver
+ */
+struct fib_mod_req {
+    __u64 k;
+    __u64 m;
+    __u64 result;
+};
+
+#define FIB_IOC_MOD _IOWR(FIB_IOC_MAGIC, 1, struct fib_mod_req)
+
+#define FIB_DIGITS_MAX 18
+
+/* leading and trailing digits of F(k), without computing F(k) itself
+ * @k: index, below 2 ** 63
+ * @d: number of digits wanted, 1 to FIB_DIGITS_MAX
+ * @count: filled by the driver, number of decimal digits of F(k)
+ * @head: filled by the driver, the first min(d, count) digits of F(k)
+ * @tail: filled by the driver, F(k) mod 10 ** d, so it has to be padded
+ *        with zeros to min(d, count) digits
+ */
+struct fib_digits_req {
+    __u64 k;
+    __u32 d;
+    __u32 reserved;
+    __u64 count;
+    __u64 head;
+    __u64 tail;
+};
+
+#define FIB_IOC_DIGITS _IOWR(FIB_IOC_MAGIC, 2, struct fib_digits_req)
+
+/* limits of every following request on the file, 0 for none
+ * A request that goes beyond either fails with -ETIMEDOUT.
+ * @time_ns: wall time of the request, including the wait for a worker
+ * @work: chunk operations of the computation, about n ** 2 for F(k) of n
+ *        chunks by fast doubling and k * n / 2 by the sequence
+ */
+struct fib_budget {
+    __u64 time_ns;
+    __u64 work;
+};
+
+#define FIB_IOC_BUDGET _IOW(FIB_IOC_MAGIC, 3, struct fib_budget)
+
+#endif
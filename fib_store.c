@@ -0,0 +1,286 @@
+#include "fib_store.h"
+#include "base.h"
+#include "ubignum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIB_STORE_MAGIC "FIBSTORE"
+#define FIB_STORE_VERSION 1
+/* tells the byte order the file was written in */
+#define FIB_STORE_ORDER 0x0102030405060708ull
+/* slots of a new store, 1 MiB of table for up to 48k records */
+#define FIB_STORE_SLOTS (1u << 16)
+/* the file grows by this much, to keep ftruncate() off most appends */
+#define FIB_STORE_GROW (1u << 20)
+/* address space reserved for the mapping, the file can't grow beyond it */
+#define FIB_STORE_RESERVE \
+    ((size_t) 1 << (sizeof(size_t) == 8 ? 40 : 28))
+
+/* @end: bytes of the file in use, the rest is room to grow
+ * @count: records, at most 3/4 of @slots
+ */
+struct fib_store_hdr {
+    char magic[8];
+    uint64_t order;
+    uint32_t version;
+    uint32_t pad;
+    uint64_t slots;
+    uint64_t count;
+    uint64_t end;
+};
+
+/* @off: offset of the record of @k, 0 for a free slot */
+struct fib_store_slot {
+    uint64_t k;
+    uint64_t off;
+};
+
+/* @map: the file, mapped over FIB_STORE_RESERVE bytes
+ * @size: size of the file
+ * @lock: serializes appends, lookups go without it
+ */
+struct fib_store {
+    int fd;
+    bool writable;
+    char *map;
+    size_t size;
+    pthread_mutex_t lock;
+};
+
+static inline struct fib_store_hdr *fib_store_hdr(const struct fib_store *s)
+{
+    return (struct fib_store_hdr *) s->map;
+}
+
+static inline struct fib_store_slot *fib_store_slots(const struct fib_store *s)
+{
+    return (struct fib_store_slot *) (s->map + sizeof(struct fib_store_hdr));
+}
+
+/* offset of the first record */
+static inline uint64_t fib_store_data(uint64_t slots)
+{
+    return sizeof(struct fib_store_hdr) + slots * sizeof(struct fib_store_slot);
+}
+
+/* the high half of the product spreads the prefixes k >> j of one k */
+static inline uint64_t fib_store_hash(uint64_t k)
+{
+    return (k * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+/* make the file at least @size bytes */
+static bool fib_store_grow(struct fib_store *s, uint64_t size)
+{
+    if (size <= s->size)
+        return true;
+    size = (size + FIB_STORE_GROW - 1) / FIB_STORE_GROW * FIB_STORE_GROW;
+    if (unlikely(size > FIB_STORE_RESERVE)) {
+        errno = EFBIG;
+        return false;
+    }
+    if (unlikely(ftruncate(s->fd, size)))
+        return false;
+    s->size = size;
+    return true;
+}
+
+/* only the header is looked at, so this takes the same time for any size */
+static int fib_store_check(struct fib_store *s)
+{
+    struct fib_store_hdr *hdr = fib_store_hdr(s);
+    if (!s->size && s->writable) {
+        if (unlikely(!fib_store_grow(s, fib_store_data(FIB_STORE_SLOTS))))
+            return -errno;
+        memcpy(hdr->magic, FIB_STORE_MAGIC, sizeof(hdr->magic));
+        hdr->order = FIB_STORE_ORDER;
+        hdr->version = FIB_STORE_VERSION;
+        hdr->slots = FIB_STORE_SLOTS;
+        hdr->count = 0;
+        hdr->end = fib_store_data(FIB_STORE_SLOTS);
+        return 0;
+    }
+    if (unlikely(s->size < sizeof(*hdr) ||
+                 memcmp(hdr->magic, FIB_STORE_MAGIC, sizeof(hdr->magic)) ||
+                 hdr->order != FIB_STORE_ORDER ||
+                 hdr->version != FIB_STORE_VERSION))
+        return -EINVAL;
+    const uint64_t slots_max =
+        FIB_STORE_RESERVE / sizeof(struct fib_store_slot);
+    if (unlikely(!hdr->slots || (hdr->slots & (hdr->slots - 1)) ||
+                 hdr->slots > slots_max ||
+                 hdr->count > hdr->slots / 4 * 3 ||
+                 hdr->end < fib_store_data(hdr->slots) ||
+                 hdr->end > s->size))
+        return -EINVAL;
+    return 0;
+}
+
+int fib_store_map(struct fib_store **store, const char *path, bool writable)
+{
+    struct fib_store *s = MALLOC(sizeof(*s));
+    if (unlikely(!s))
+        return -ENOMEM;
+    s->writable = writable;
+    s->map = MAP_FAILED;
+    s->fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    int err = 0;
+    if (unlikely(s->fd < 0))
+        goto fail_errno;
+    /* one writer, or any number of readers, across processes */
+    if (unlikely(flock(s->fd, (writable ? LOCK_EX : LOCK_SH) | LOCK_NB))) {
+        err = errno == EWOULDBLOCK ? -EBUSY : -errno;
+        goto fail;
+    }
+    struct stat st;
+    if (unlikely(fstat(s->fd, &st)))
+        goto fail_errno;
+    if (unlikely((uint64_t) st.st_size > FIB_STORE_RESERVE)) {
+        err = -EFBIG;
+        goto fail;
+    }
+    s->size = st.st_size;
+    /* Mapping past the end of the file is fine as long as nothing beyond it
+     * is touched. Growing the file then extends what the mapping shows, and
+     * the records never move.
+     */
+    s->map = mmap(NULL, FIB_STORE_RESERVE,
+                  writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                  s->fd, 0);
+    if (unlikely(s->map == MAP_FAILED))
+        goto fail_errno;
+    err = fib_store_check(s);
+    if (unlikely(err))
+        goto fail;
+    pthread_mutex_init(&s->lock, NULL);
+    *store = s;
+    return 0;
+fail_errno:
+    err = -errno;
+fail:
+    if (s->map != MAP_FAILED)
+        munmap(s->map, FIB_STORE_RESERVE);
+    if (s->fd >= 0)
+        close(s->fd);
+    FREE(s);
+    return err;
+}
+
+void fib_store_unmap(struct fib_store *store)
+{
+    if (!store)
+        return;
+    pthread_mutex_destroy(&store->lock);
+    munmap(store->map, FIB_STORE_RESERVE);
+    /* closing drops the flock() as well */
+    close(store->fd);
+    FREE(store);
+}
+
+const struct fib_store_rec *fib_store_find(const struct fib_store *store,
+                                           uint64_t k)
+{
+    const struct fib_store_hdr *hdr = fib_store_hdr(store);
+    struct fib_store_slot *slots = fib_store_slots(store);
+    const uint64_t mask = hdr->slots - 1;
+    /* a damaged table may have no free slot to end the probe */
+    uint64_t i = fib_store_hash(k) & mask;
+    for (uint64_t probe = 0; probe < hdr->slots; probe++, i = (i + 1) & mask) {
+        /* pairs with the release in fib_store_add() */
+        const uint64_t off = __atomic_load_n(&slots[i].off, __ATOMIC_ACQUIRE);
+        if (!off)
+            return NULL;
+        if (slots[i].k != k)
+            continue;
+        /* a damaged file must not send the caller out of the mapping */
+        const struct fib_store_rec *rec =
+            (const struct fib_store_rec *) (store->map + off);
+        const uint64_t end = __atomic_load_n(&hdr->end, __ATOMIC_ACQUIRE);
+        if (unlikely(off > end - sizeof(*rec) || rec->k != k ||
+                     rec->n[0] > (end - off - sizeof(*rec)) / 8 ||
+                     rec->n[1] > (end - off - sizeof(*rec)) / 8 - rec->n[0]))
+            return NULL;
+        return rec;
+    }
+    return NULL;
+}
+
+bool fib_store_add(struct fib_store *store, uint64_t k, ubn_t *const f[2])
+{
+    if (!store->writable)
+        return false;
+    const uint64_t n[2] = {ubn_limbs_count(f[0]), ubn_limbs_count(f[1])};
+    const uint64_t bytes = sizeof(struct fib_store_rec) + 8 * (n[0] + n[1]);
+    bool ok = false;
+
+    pthread_mutex_lock(&store->lock);
+    struct fib_store_hdr *hdr = fib_store_hdr(store);
+    struct fib_store_slot *slots = fib_store_slots(store);
+    const uint64_t mask = hdr->slots - 1;
+    if (unlikely(hdr->count >= hdr->slots / 4 * 3))
+        goto out;
+    uint64_t i = fib_store_hash(k) & mask, probe = 0;
+    for (; slots[i].off; i = (i + 1) & mask) {
+        if (slots[i].k == k || unlikely(++probe == hdr->slots))
+            goto out;
+    }
+    const uint64_t off = hdr->end;
+    if (unlikely(!fib_store_grow(store, off + bytes)))
+        goto out;
+    struct fib_store_rec *rec = (struct fib_store_rec *) (store->map + off);
+    rec->k = k;
+    rec->n[0] = n[0];
+    rec->n[1] = n[1];
+    ubn_limbs_export(f[0], rec->limbs);
+    ubn_limbs_export(f[1], rec->limbs + n[0]);
+    /* The record is counted in before the slot shows it, so a crash in
+     * between only leaves unused bytes behind.
+     */
+    __atomic_store_n(&hdr->end, off + bytes, __ATOMIC_RELEASE);
+    hdr->count++;
+    slots[i].k = k;
+    __atomic_store_n(&slots[i].off, off, __ATOMIC_RELEASE);
+    ok = true;
+out:
+    pthread_mutex_unlock(&store->lock);
+    return ok;
+}
+
+void ubn_limbs_export(const ubn_t *N, uint64_t *limbs)
+{
+#if CPU64
+    memcpy(limbs, N->data, sizeof(uint64_t) * N->size);
+#else
+    const size_t n = ubn_limbs_count(N);
+    memset(limbs, 0, sizeof(uint64_t) * n);
+    for (uint32_t i = 0; i < N->size; i++)
+        limbs[i / 2] |= (uint64_t) N->data[i] << (i & 1 ? 32 : 0);
+#endif
+}
+
+bool ubn_limbs_import(ubn_t *N, const uint64_t *limbs, size_t n)
+{
+    while (n && !limbs[n - 1])
+        n--;
+    const size_t chunks = n * (64 / UBN_UNIT_BIT);
+    if (unlikely(chunks > N->capacity))
+        return false;
+#if CPU64
+    memcpy(N->data, limbs, sizeof(uint64_t) * n);
+#else
+    for (size_t i = 0; i < chunks; i++)
+        N->data[i] = limbs[i / 2] >> (i & 1 ? 32 : 0);
+#endif
+    memset(N->data + chunks, 0, (N->capacity - chunks) * sizeof(ubn_unit_t));
+    N->size = chunks;
+    while (N->size && !N->data[N->size - 1])
+        N->size--;
+    return true;
+}
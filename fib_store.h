@@ -0,0 +1,55 @@
+#ifndef __FIB_STORE_H
+#define __FIB_STORE_H
+
+/* Results of fast doubling kept on disk across runs, for libubignum
+ * The file is a header, an open addressing table of slots keyed by k, and the
+ * records the slots point to, appended one after another. It is mapped once
+ * at an address that never moves, so opening it doesn't depend on its size
+ * and records are read in place.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ubignum.h"
+
+/* smaller F(k) are cheaper to compute than to keep */
+#define FIB_STORE_MIN_K 1024
+
+/* F(k - 1) and F(k) as 64-bit limbs, least significant first
+ * @n: number of limbs of F(k - 1) and F(k)
+ * @limbs: F(k - 1) followed by F(k)
+ */
+struct fib_store_rec {
+    uint64_t k;
+    uint64_t n[2];
+    uint64_t limbs[];
+};
+
+struct fib_store;
+
+/* 0 or a negative errno, -EBUSY if another process writes the store */
+int fib_store_map(struct fib_store **store, const char *path, bool writable);
+void fib_store_unmap(struct fib_store *store);
+
+/* the record of k, NULL if none, it is valid until fib_store_unmap() */
+const struct fib_store_rec *fib_store_find(const struct fib_store *store,
+                                           uint64_t k);
+
+/* Append F(k - 1) and F(k) unless k is there already. It is false when the
+ * store is read-only, full or can't grow.
+ */
+bool fib_store_add(struct fib_store *store, uint64_t k, ubn_t *const f[2]);
+
+/* limbs to hold @N */
+static inline size_t ubn_limbs_count(const ubn_t *N)
+{
+    return ((size_t) N->size * UBN_UNIT_BIT + 63) / 64;
+}
+
+void ubn_limbs_export(const ubn_t *N, uint64_t *limbs);
+/* false if @N has too little capacity */
+bool ubn_limbs_import(ubn_t *N, const uint64_t *limbs, size_t n);
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef __FIB_USPACE_H
+#define __FIB_USPACE_H
+
+/* The kernel interfaces fibdrv.c uses, on top of libc and pthreads, so that
+ * it builds with -DKSPACE=0 into a user space program and its file operations
+ * can be called and profiled without loading the module. Only the part that
+ * serves requests is built, the registration of the device stays in the
+ * kernel.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "list.h"
+
+typedef int64_t s64;
+#define U32_MAX UINT32_MAX
+#define U64_MAX UINT64_MAX
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define READ_ONCE(x) (*(volatile typeof(x) *) &(x))
+#define WRITE_ONCE(x, v) (*(volatile typeof(x) *) &(x) = (v))
+#define __user
+#define __init
+#define __exit
+
+#define KERN_INFO ""
+#define KERN_ALERT ""
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define pr_err(...) fprintf(stderr, __VA_ARGS__)
+
+/* the module glue is dropped, parameters are plain variables */
+#define MODULE_LICENSE(s)
+#define MODULE_AUTHOR(s)
+#define MODULE_DESCRIPTION(s)
+#define MODULE_VERSION(s)
+#define MODULE_PARM_DESC(name, desc)
+#define module_param(name, type, perm)
+#define module_param_named(name, var, type, perm)
+/* what insmod and rmmod would run */
+#define module_init(fn)       \
+    int fib_module_init(void) \
+    {                         \
+        return fn();          \
+    }
+#define module_exit(fn)        \
+    void fib_module_exit(void) \
+    {                          \
+        fn();                  \
+    }
+
+/* memory: user copies are plain copies of the caller's own buffers */
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kfree(ptr) free(ptr)
+
+static inline unsigned long copy_to_user(void *to, const void *from,
+                                         unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from,
+                                           unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+/* time */
+typedef s64 ktime_t;
+
+static inline ktime_t ktime_get(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (s64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define ktime_get_ns() ((uint64_t) ktime_get())
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_to_ns(kt) (kt)
+
+/* the calling thread is the task, and it never gets a fatal signal */
+struct task_struct;
+#define current ((struct task_struct *) NULL)
+#define fatal_signal_pending(task) ((void) (task), 0)
+#define cond_resched() \
+    do {               \
+    } while (0)
+
+/* locks */
+typedef pthread_mutex_t spinlock_t;
+#define spin_lock_init(lock) pthread_mutex_init(lock, NULL)
+#define spin_lock(lock) pthread_mutex_lock(lock)
+#define spin_unlock(lock) pthread_mutex_unlock(lock)
+
+typedef struct {
+    int64_t counter;
+} atomic64_t;
+
+#define atomic64_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic64_inc(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+
+/* wait queues, the condition is checked under @lock so no wake up is lost */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+}
+
+static inline void wake_up(wait_queue_head_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+#define wait_event_killable(wq, condition)             \
+    ({                                                 \
+        pthread_mutex_lock(&(wq).lock);                \
+        while (!(condition))                           \
+            pthread_cond_wait(&(wq).cond, &(wq).lock); \
+        pthread_mutex_unlock(&(wq).lock);              \
+        0;                                             \
+    })
+
+struct completion {
+    wait_queue_head_t wait;
+    bool done;
+};
+
+static inline void init_completion(struct completion *c)
+{
+    init_waitqueue_head(&c->wait);
+    c->done = false;
+}
+
+static inline void complete(struct completion *c)
+{
+    pthread_mutex_lock(&c->wait.lock);
+    c->done = true;
+    pthread_cond_broadcast(&c->wait.cond);
+    pthread_mutex_unlock(&c->wait.lock);
+}
+
+static inline void wait_for_completion(struct completion *c)
+{
+    wait_event_killable(c->wait, c->done);
+}
+
+#define wait_for_completion_killable(c) (wait_for_completion(c), 0)
+
+/* Work runs in the thread that queues it, once one of the @max_active slots
+ * of the queue is free, so the queue still bounds the requests computed at
+ * once.
+ */
+struct work_struct {
+    void (*func)(struct work_struct *work);
+};
+
+struct workqueue_struct {
+    sem_t active;
+};
+
+#define WQ_UNBOUND 0
+#define INIT_WORK_ONSTACK(w, fn) ((w)->func = (fn))
+#define destroy_work_on_stack(w) ((void) (w))
+
+static inline struct workqueue_struct *alloc_workqueue(const char *name,
+                                                       unsigned int flags,
+                                                       int max_active)
+{
+    struct workqueue_struct *wq = malloc(sizeof(*wq));
+    if (wq && sem_init(&wq->active, 0, max_active)) {
+        free(wq);
+        wq = NULL;
+    }
+    return wq;
+}
+
+static inline void destroy_workqueue(struct workqueue_struct *wq)
+{
+    sem_destroy(&wq->active);
+    free(wq);
+}
+
+static inline bool queue_work(struct workqueue_struct *wq,
+                              struct work_struct *work)
+{
+    while (sem_wait(&wq->active))
+        ;
+    work->func(work);
+    sem_post(&wq->active);
+    return true;
+}
+
+/* files: what the file operations of fibdrv.c look at */
+struct inode;
+struct module;
+#define THIS_MODULE ((struct module *) NULL)
+
+struct file {
+    loff_t f_pos;
+    void *private_data;
+};
+
+struct file_operations {
+    struct module *owner;
+    ssize_t (*read)(struct file *, char *, size_t, loff_t *);
+    ssize_t (*write)(struct file *, const char *, size_t, loff_t *);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    loff_t (*llseek)(struct file *, loff_t, int);
+};
+
+/* the driver as a program sees it */
+extern const struct file_operations fib_fops;
+int fib_module_init(void);
+void fib_module_exit(void);
+
+#endif
@@ -0,0 +1,149 @@
+/* The file operations of fibdrv.c called in-process, built with -DKSPACE=0,
+ * so the driver path can be timed and profiled without loading the module.
+ * Prints "k,average time (ns)" like exp, for time_plot.gp.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "base.h"
+#include "fib_engine.h"
+#include "fib_ioctl.h"
+#include "fib_uspace.h"
+#include "ubignum.h"
+
+/* @engine: time write() by this engine, or read() if negative
+ * @total: ns spent in @rounds calls
+ */
+struct bench {
+    pthread_t thread;
+    uint64_t k;
+    int engine;
+    int rounds;
+    uint64_t total;
+    int rc;
+};
+
+static void *bench_run(void *arg)
+{
+    struct bench *b = arg;
+    struct file file = {0};
+    char *buf = NULL;
+    /* fib_read() wants the whole result to fit */
+    const size_t size = fib_digits(b->k) + 2;
+    b->total = 0;
+    b->rc = fib_fops.open(NULL, &file);
+    if (b->rc)
+        goto done;
+    if (b->engine < 0 && !(buf = malloc(size))) {
+        b->rc = -ENOMEM;
+        goto out;
+    }
+    for (int i = 0; i < b->rounds; i++) {
+        fib_fops.llseek(&file, b->k, SEEK_SET);
+        ssize_t rc;
+        if (b->engine >= 0) {
+            /* the time of the engine alone, as measured by the driver */
+            rc = fib_fops.write(&file, NULL, b->engine, &file.f_pos);
+            if (rc > 0)
+                b->total += rc;
+        } else {
+            /* the whole path: computation, conversion and copy */
+            const uint64_t t = ktime_get_ns();
+            rc = fib_fops.read(&file, buf, size, &file.f_pos);
+            b->total += ktime_get_ns() - t;
+        }
+        if (rc < 0) {
+            b->rc = rc;
+            break;
+        }
+    }
+    free(buf);
+out:
+    fib_fops.release(NULL, &file);
+done:
+    /* the blocks pooled by ubignum.c are per thread */
+    ubignum_cache_exit();
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-w engine] [-n rounds] [-j threads] first [last "
+            "[step]]\n"
+            "  -w  time write() by one of FIB_ENGINE_*, read() by default\n"
+            "  -n  calls averaged for each k, 10 by default\n"
+            "  -j  threads calling at once, 1 by default\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int engine = -1, rounds = 10, threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:n:j:")) != -1) {
+        switch (opt) {
+        case 'w':
+            engine = atoi(optarg);
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc || rounds < 1 || threads < 1 ||
+        engine >= FIB_ENGINE_MAX)
+        usage(argv[0]);
+    const uint64_t first = strtoull(argv[optind], NULL, 0);
+    const uint64_t last =
+        optind + 1 < argc ? strtoull(argv[optind + 1], NULL, 0) : first;
+    const uint64_t step =
+        optind + 2 < argc ? strtoull(argv[optind + 2], NULL, 0) : 1;
+    if (!step)
+        usage(argv[0]);
+
+    if (fib_module_init()) {
+        fprintf(stderr, "Failed to set up the driver\n");
+        return 1;
+    }
+    struct bench *b = calloc(threads, sizeof(*b));
+    int status = b ? 0 : 1;
+    for (uint64_t k = first; b && k <= last; k += step) {
+        uint64_t total = 0;
+        for (int i = 0; i < threads; i++) {
+            b[i] = (struct bench){.k = k, .engine = engine, .rounds = rounds};
+            /* without a thread, this caller runs the share */
+            if (pthread_create(&b[i].thread, NULL, bench_run, &b[i])) {
+                b[i].thread = pthread_self();
+                bench_run(&b[i]);
+            }
+        }
+        for (int i = 0; i < threads; i++) {
+            if (!pthread_equal(b[i].thread, pthread_self()))
+                pthread_join(b[i].thread, NULL);
+            total += b[i].total;
+            if (b[i].rc)
+                status = b[i].rc;
+        }
+        if (status) {
+            fprintf(stderr, "F(%llu): %s\n", (unsigned long long) k,
+                    strerror(-status));
+            break;
+        }
+        printf("%llu,%llu\n", (unsigned long long) k,
+               (unsigned long long) (total / rounds / threads));
+        if (last - k < step)
+            break;
+    }
+    free(b);
+    fib_module_exit();
+    return status ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+/* Command line front end of libubignum, F(k) without /dev/fibonacci */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libubignum.h"
+
+enum op { OP_READ, OP_TIME, OP_MOD, OP_DIGITS };
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-e engine] [-t | -M modulus | -d digits]\n"
+            "          [-T time_ns] [-W work] [-s store | -S store] k...\n"
+            "  -e  one of FIB_ENGINE_*, fast doubling by default\n"
+            "  -t  print the time of the computation in ns instead of F(k)\n"
+            "  -M  print F(k) mod modulus instead of F(k)\n"
+            "  -d  print the number of digits, the leading and the trailing\n"
+            "      digits of F(k) instead of F(k)\n"
+            "  -T  -W  limits of each computation, as FIB_IOC_BUDGET\n"
+            "  -s  read results from the store file\n"
+            "  -S  the same, and add new results to it\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    enum op op = OP_READ;
+    unsigned int engine = FIB_ENGINE_FAST;
+    uint64_t mod = 0;
+    uint32_t digits = 0;
+    struct fib_budget budget = {0, 0};
+    const char *store = NULL;
+    bool writable = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:tM:d:T:W:s:S:")) != -1) {
+        switch (opt) {
+        case 'e':
+            engine = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            op = OP_TIME;
+            break;
+        case 'M':
+            op = OP_MOD;
+            mod = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            op = OP_DIGITS;
+            digits = strtoul(optarg, NULL, 0);
+            break;
+        case 'T':
+            budget.time_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'W':
+            budget.work = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+        case 'S':
+            store = optarg;
+            writable = opt == 'S';
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc)
+        usage(argv[0]);
+    if (store) {
+        const int rc = ubn_store_open(store, writable);
+        if (rc < 0) {
+            fprintf(stderr, "%s: %s\n", store, strerror(-rc));
+            return 1;
+        }
+    }
+
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        const uint64_t k = strtoull(argv[i], NULL, 0);
+        long long rc = 0;
+        switch (op) {
+        case OP_READ: {
+            const size_t size = ubn_fib_size(k);
+            char *buf = malloc(size);
+            if (!buf) {
+                rc = -ENOMEM;
+                break;
+            }
+            rc = ubn_fib_read(k, engine, buf, size, &budget);
+            if (rc > 0)
+                puts(buf);
+            free(buf);
+            break;
+        }
+        case OP_TIME:
+            rc = ubn_fib_time(k, engine, &budget);
+            if (rc >= 0)
+                printf("%lld\n", rc);
+            break;
+        case OP_MOD: {
+            struct fib_mod_req req = {.k = k, .m = mod};
+            rc = ubn_fib_mod(&req);
+            if (!rc)
+                printf("%llu\n", (unsigned long long) req.result);
+            break;
+        }
+        case OP_DIGITS: {
+            struct fib_digits_req req = {.k = k, .d = digits};
+            rc = ubn_fib_digits(&req);
+            if (!rc) {
+                const int w = req.count < req.d ? req.count : req.d;
+                printf("%llu %llu...%0*llu\n", (unsigned long long) req.count,
+                       (unsigned long long) req.head, w,
+                       (unsigned long long) req.tail);
+            }
+            break;
+        }
+        }
+        if (rc < 0) {
+            fprintf(stderr, "F(%llu): %s\n", (unsigned long long) k,
+                    strerror(-rc));
+            status = 1;
+        }
+    }
+    ubn_store_close();
+    return status;
+}
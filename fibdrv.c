@@ -1,14 +1,36 @@
+#include "base.h"
+
+#if KSPACE
+#include <linux/atomic.h>
 #include <linux/cdev.h>
+#include <linux/completion.h>
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/kdev_t.h>
 #include <linux/kernel.h>
+#include <linux/limits.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/spinlock.h>
+#include <linux/sysfs.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#else
+#include "fib_uspace.h"
+#endif
 
-#include "base.h"
+#include "fib_engine.h"
+#include "fib_ioctl.h"
+#include "fibmod.h"
 #include "ubignum.h"
+#include "ubn_limb.h"
+#include "ubn_simd.h"
 
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_AUTHOR("National Cheng Kung University, Taiwan");
@@ -17,100 +39,621 @@ MODULE_VERSION("0.1");
 
 #define DEV_FIBONACCI_NAME "fibonacci"
 
-#define MAX_LENGTH 1000001
+#define MAX_LENGTH LLONG_MAX
+
+/* F(0) ... F(FIB_TABLE_SIZE - 1) are served from fib_table */
+#define FIB_TABLE_SIZE 500
+
+static unsigned long mem_limit = 256ul << 20;
+module_param(mem_limit, ulong, 0644);
+MODULE_PARM_DESC(mem_limit, "Max estimated memory in bytes for one request");
+
+static unsigned int inline_limbs = 64;
+module_param(inline_limbs, uint, 0644);
+MODULE_PARM_DESC(inline_limbs,
+                 "Results of at most this many chunks are computed inline");
+
+static unsigned int sched_workers = 4;
+module_param(sched_workers, uint, 0444);
+MODULE_PARM_DESC(sched_workers, "Max larger requests computed at once");
+
+static unsigned long sched_mem = 1ul << 30;
+module_param(sched_mem, ulong, 0644);
+MODULE_PARM_DESC(sched_mem,
+                 "Max estimated memory in bytes of the larger requests");
+
+static unsigned int read_engine = FIB_ENGINE_FAST;
+module_param(read_engine, uint, 0644);
+MODULE_PARM_DESC(read_engine, "Engine of read(), one of FIB_ENGINE_*");
+
+module_param_named(par_limbs, fib_par_limbs, uint, 0644);
+MODULE_PARM_DESC(par_limbs,
+                 "Steps of at least this many chunks run in parallel");
 
+static bool verify;
+module_param(verify, bool, 0644);
+MODULE_PARM_DESC(verify,
+                 "Check computed results against F(k) mod a few primes");
+
+#if KSPACE
 static dev_t fib_dev = 0;
 static struct cdev *fib_cdev;
 static struct class *fib_class;
-static DEFINE_MUTEX(fib_mutex);
+#endif
+
+/* decimal strings of the small results, built once by fib_table_init()
+ * @str: every string with its terminating '\0', one after another
+ * @off: F(k) occupies str[off[k] : off[k + 1]]
+ */
+static struct {
+    char *str;
+    uint32_t off[FIB_TABLE_SIZE + 1];
+} fib_table;
+
+/* Estimate the peak memory in bytes to serve F(k).
+ * The ladder keeps up to 7 numbers of fib_capacity(k) chunks. Converting to
+ * decimal takes 3 copies in ubn_div_t, the remainders of the blocks and the
+ * final string.
+ * If @decimal is false, only the computation is counted.
+ */
+static uint64_t fib_mem_cost(uint64_t k, bool decimal)
+{
+    const uint64_t limbs = fib_limbs(k);
+    uint64_t cost = (limbs + 2) * sizeof(ubn_unit_t) * 7;
+    if (decimal)
+        cost += limbs * sizeof(ubn_unit_t) * 4 + fib_digits(k);
+    return cost;
+}
+
+/* reject requests whose estimated memory usage is beyond @mem_limit */
+static inline bool fib_admit(uint64_t k, bool decimal)
+{
+    return fib_limbs(k) <= U32_MAX / 2 &&
+           fib_mem_cost(k, decimal) <= READ_ONCE(mem_limit);
+}
+
+/* state of one request, checked by the long loops
+ * @poll: hook handed to the conversion
+ * @deadline: ktime_get_ns() beyond which the request times out, 0 for none
+ * @work: chunk operations the computation may still spend
+ * @task: the caller, whose fatal signals abort the request
+ * @err: 0, or why the request was given up
+ */
+struct fib_ctx {
+    ubn_poll_t poll;
+    struct task_struct *task;
+    uint64_t deadline;
+    uint64_t work;
+    int err;
+};
+
+/* Charge @work chunk operations to the request, give the CPU away if needed
+ * and tell whether the request may go on. @ctx may be NULL.
+ */
+bool fib_check(struct fib_ctx *ctx, uint64_t work)
+{
+    if (!ctx)
+        return true;
+    if (unlikely(ctx->err))
+        return false;
+    cond_resched();
+    if (unlikely(fatal_signal_pending(ctx->task)))
+        ctx->err = -EINTR;
+    else if (unlikely(ctx->work < work ||
+                      (ctx->deadline && ktime_get_ns() > ctx->deadline)))
+        ctx->err = -ETIMEDOUT;
+    else
+        ctx->work -= work;
+    return !ctx->err;
+}
+
+static bool fib_poll(ubn_poll_t *p)
+{
+    return fib_check(container_of(p, struct fib_ctx, poll), 0);
+}
 
-static ubn_t *fib_sequence(long long k)
+/* state of an open file, the calls on it may run at once
+ * @lock: protects @budget and @rewind
+ * @budget: limits of each request, set by FIB_IOC_BUDGET
+ * @rewind: set by a seek, the next fib_read_iter() starts over
+ * @mutex: serializes fib_read_iter(), protects the members below it
+ * @k: the k whose result fib_read_iter() is sending, -1 for none
+ * @str: @len chars of F(@k) as fib_render() gave them, NULL once all sent
+ * @owned: what fib_render() gave to free
+ * @done: chars of @str already sent
+ */
+struct fib_file {
+    spinlock_t lock;
+    struct fib_budget budget;
+#if KSPACE
+    bool rewind;
+    struct mutex mutex;
+    loff_t k;
+    const char *str;
+    char *owned;
+    size_t len;
+    size_t done;
+#endif
+};
+
+/* start a request under the budget set on @file */
+static void fib_ctx_init(struct fib_ctx *ctx, struct file *file)
 {
-    ubn_t *fib[2];
-    bool flag = true;
-    fib[0] = ubignum_init(UBN_DEFAULT_CAPACITY);
-    flag &= !!fib[0];
-    ubignum_set_zero(fib[0]);
-    fib[1] = ubignum_init(UBN_DEFAULT_CAPACITY);
-    flag &= !!fib[1];
-    ubignum_set_u64(fib[1], 1);
-
-    for (int i = 2; i <= k; i++)
-        flag &= ubignum_add(fib[0], fib[1], &fib[i & 1]);
-    ubignum_free(fib[(k & 1) ^ 1]);
-    if (unlikely(!flag))
-        printk(KERN_INFO "@flag in fib_sequence() reported false\n");
-    return fib[k & 1];
+    struct fib_file *f = file->private_data;
+    spin_lock(&f->lock);
+    const struct fib_budget budget = f->budget;
+    spin_unlock(&f->lock);
+    ctx->poll.fn = fib_poll;
+    ctx->task = current;
+    ctx->deadline = budget.time_ns ? ktime_get_ns() + budget.time_ns : 0;
+    ctx->work = budget.work ? budget.work : U64_MAX;
+    ctx->err = 0;
 }
 
-static ubn_t *fib_fast(long long k)
+static int fib_table_init(void)
 {
-    ubn_t *fast[5];
-    bool flag = true;
-    if (k == 0) {
-        fast[2] = ubignum_init(UBN_DEFAULT_CAPACITY);
-        flag &= !!fast[2];
-        ubignum_set_zero(fast[2]);
-        goto end;
-    } else if (k == 1) {
-        fast[2] = ubignum_init(UBN_DEFAULT_CAPACITY);
-        flag &= !!fast[2];
-        ubignum_set_u64(fast[2], 1);
-        goto end;
+    /* one spare entry, ubignum_digits_bound() may be a digit or two above */
+    size_t total = fib_digits(FIB_TABLE_SIZE);
+    for (uint64_t k = 0; k < FIB_TABLE_SIZE; k++)
+        total += fib_digits(k) + 1;
+    fib_table.str = MALLOC(total);
+    ubn_t *a = ubignum_init(fib_capacity(FIB_TABLE_SIZE));
+    ubn_t *b = ubignum_init(fib_capacity(FIB_TABLE_SIZE));
+    if (unlikely(!fib_table.str || !a || !b))
+        goto failed;
+    ubignum_set_zero(a);
+    ubignum_set_u64(b, 1);
+
+    fib_table.off[0] = 0;
+    for (uint32_t k = 0; k < FIB_TABLE_SIZE; k++) {
+        /* a = F(k), b = F(k + 1) */
+        uint32_t len;
+        if (unlikely(!ubignum_2decimal_buf(a, fib_table.str + fib_table.off[k],
+                                           total - fib_table.off[k], &len,
+                                           NULL)))
+            goto failed;
+        fib_table.off[k + 1] = fib_table.off[k] + len + 1;
+        if (unlikely(!ubignum_add(a, b, &a)))
+            goto failed;
+        ubignum_swapptr(&a, &b);
     }
+    ubignum_free(a);
+    ubignum_free(b);
+    return 0;
+failed:
+    ubignum_free(a);
+    ubignum_free(b);
+    FREE(fib_table.str);
+    fib_table.str = NULL;
+    return -ENOMEM;
+}
 
-    for (int i = 0; i < 5; i++) {
-        fast[i] = ubignum_init(UBN_DEFAULT_CAPACITY);
-        flag &= !!fast[i];
+/* one request and its result
+ * @fn: computes the result of @k, and returns 0 or -errno
+ * @engine: one of the FIB_ENGINE_*
+ * @str, @len: the result of fib_job_render()
+ * @ns: the result of fib_job_time()
+ * @queued: ktime_get_ns() when it was handed to the workers
+ */
+struct fib_job {
+    struct work_struct work;
+    struct completion done;
+    struct fib_ctx *ctx;
+    int (*fn)(struct fib_job *job);
+    uint64_t k;
+    size_t engine;
+    char *str;
+    size_t len;
+    s64 ns;
+    uint64_t queued;
+    int rc;
+};
+
+/* F(k) by one of the FIB_ENGINE_* */
+static ubn_t *fib_compute(uint64_t k, size_t engine, struct fib_ctx *ctx)
+{
+    switch (engine) {
+    case FIB_ENGINE_SEQUENCE:
+        return fib_sequence(k, ctx);
+    case FIB_ENGINE_PARALLEL:
+        return fib_fast(k, ctx, true);
+    case FIB_ENGINE_CARRY_SAVE:
+        return fib_sequence_red(k, ctx);
+    default:
+        return fib_fast(k, ctx, false);
     }
-    ubignum_set_zero(fast[1]);
-    ubignum_set_u64(fast[2], 1);
-    int n = 1;
-    for (int currbit = 1 << (32 - __builtin_clzll(k) - 1 - 1); currbit;
-         currbit = currbit >> 1) {
-        /* compute 2n-1 */
-        flag &= ubignum_square(fast[1], &fast[0]);
-        flag &= ubignum_square(fast[2], &fast[3]);
-        // flag &= ubignum_mult(fast[1], fast[1], &fast[0]);
-        // flag &= ubignum_mult(fast[2], fast[2], &fast[3]);
-        flag &= ubignum_add(fast[0], fast[3], &fast[3]);
-        /* compute 2n */
-        flag &= ubignum_left_shift(fast[1], 1, &fast[4]);
-        flag &= ubignum_add(fast[4], fast[2], &fast[4]);
-        flag &= ubignum_mult(fast[4], fast[2], &fast[4]);
-        n *= 2;
-        if (k & currbit) {
-            flag &= ubignum_add(fast[3], fast[4], &fast[0]);
-            n++;
-            ubignum_swapptr(&fast[2], &fast[0]);
-            ubignum_swapptr(&fast[1], &fast[4]);
-        } else {
-            ubignum_swapptr(&fast[2], &fast[4]);
-            ubignum_swapptr(&fast[1], &fast[3]);
+}
+
+/* odd primes above 2 ** 63 that results are checked against */
+static const uint64_t fib_verify_primes[] = {
+    0xFFFFFFFFFFFFFFC5u,  // 2 ** 64 - 59
+    0xFFFFFFFFFFFFFFADu,  // 2 ** 64 - 83
+    0xFFFFFFFFFFFFFFA1u,  // 2 ** 64 - 95
+};
+
+/* results checked by fib_verify() and how many of them were wrong */
+static atomic64_t fib_verify_checked;
+static atomic64_t fib_verify_failed;
+
+/* Compare F(k) mod each of fib_verify_primes, in O(log k) steps, with the
+ * result reduced mod the same prime. Exactly one of @N and @D is given.
+ * Return 0, or -EIO if the result is wrong.
+ */
+static int fib_verify(uint64_t k, const ubn_t *N, const ubn_dec_t *D)
+{
+    atomic64_inc(&fib_verify_checked);
+    for (size_t i = 0; i < ARRAY_SIZE(fib_verify_primes); i++) {
+        const uint64_t q = fib_verify_primes[i];
+        if (fib_mod(k, q) != (N ? ubignum_mod(N, q) : ubn_dec_mod(D, q))) {
+            atomic64_inc(&fib_verify_failed);
+            pr_err("fibdrv: F(%llu) failed the check mod %llu\n",
+                   (unsigned long long) k, (unsigned long long) q);
+            return -EIO;
         }
     }
-    ubignum_free(fast[0]);
-    ubignum_free(fast[1]);
-    ubignum_free(fast[3]);
-    ubignum_free(fast[4]);
-end:;
-    if (unlikely(!flag))
-        printk(KERN_INFO "@flag in fib_fast() reported false\n");
-    return fast[2];
+    return 0;
 }
 
-static int fib_open(struct inode *inode, struct file *file)
+/* F(k) by the decimal engine with its terminating '\0' */
+static int fib_job_render_dec(struct fib_job *job)
+{
+    struct fib_ctx *ctx = job->ctx;
+    ubn_dec_t *N = fib_sequence_dec(job->k, ctx);
+    if (unlikely(!N))
+        return ctx->err ? ctx->err : -ENOMEM;
+    const int rc = READ_ONCE(verify) ? fib_verify(job->k, NULL, N) : 0;
+    if (unlikely(rc)) {
+        ubn_dec_free(N);
+        return rc;
+    }
+    const uint32_t bound = ubn_dec_digits_bound(N) + 1;
+    char *s = (char *) MALLOC(bound);
+    uint32_t n;
+    if (unlikely(!s || !ubn_dec_2decimal_buf(N, s, bound, &n))) {
+        ubn_dec_free(N);
+        FREE(s);
+        return -ENOMEM;
+    }
+    ubn_dec_free(N);
+    job->str = s;
+    job->len = n + 1;
+    return 0;
+}
+
+/* F(k) in decimal with its terminating '\0' */
+static int fib_job_render(struct fib_job *job)
+{
+    struct fib_ctx *ctx = job->ctx;
+    if (job->engine == FIB_ENGINE_DECIMAL)
+        return fib_job_render_dec(job);
+    ubn_t *N = fib_compute(job->k, job->engine, ctx);
+    if (unlikely(!N))
+        return ctx->err ? ctx->err : -ENOMEM;
+    const int rc = READ_ONCE(verify) ? fib_verify(job->k, N, NULL) : 0;
+    if (unlikely(rc)) {
+        ubignum_free(N);
+        return rc;
+    }
+    /* digits go straight to the buffer copied out */
+    const uint32_t bound = ubignum_digits_bound(N) + 1;
+    char *s = (char *) MALLOC(bound);
+    uint32_t n;
+    if (unlikely(!s ||
+                 !ubignum_2decimal_buf(N, s, bound, &n, &ctx->poll))) {
+        ubignum_free(N);
+        FREE(s);
+        return ctx->err ? ctx->err : -ENOMEM;
+    }
+    ubignum_free(N);
+    job->str = s;
+    job->len = n + 1;
+    return 0;
+}
+
+/* time the computation of F(k) by the selected engine */
+static int fib_job_time(struct fib_job *job)
+{
+    struct fib_ctx *ctx = job->ctx;
+    ktime_t kt = ktime_get();
+    if (job->engine == FIB_ENGINE_DECIMAL) {
+        ubn_dec_t *N = fib_sequence_dec(job->k, ctx);
+        kt = ktime_sub(ktime_get(), kt);
+        if (unlikely(!N))
+            return ctx->err ? ctx->err : -ENOMEM;
+        ubn_dec_free(N);
+        job->ns = ktime_to_ns(kt);
+        return 0;
+    }
+    ubn_t *N = fib_compute(job->k, job->engine, ctx);
+    kt = ktime_sub(ktime_get(), kt);
+    if (unlikely(!N))
+        return ctx->err ? ctx->err : -ENOMEM;
+    ubignum_free(N);
+    job->ns = ktime_to_ns(kt);
+    return 0;
+}
+
+/* The larger requests run on a workqueue of @sched_workers, and only while
+ * the memory they are estimated to take fits in @sched_mem.
+ * @lock: protects the members below it
+ * @mem: estimated memory of the requests on the workers
+ * @depth: requests waiting for memory or a worker
+ * @max_depth: the highest @depth seen
+ * @queued: requests given to the workers
+ * @wait_ns: total time the requests waited before a worker took them
+ * @max_wait_ns: the longest of those waits
+ * @inlined: requests computed inline, the table lookups are not counted
+ */
+static struct {
+    struct workqueue_struct *wq;
+    wait_queue_head_t mem_wait;
+    spinlock_t lock;
+    uint64_t mem;
+    uint32_t depth;
+    uint32_t max_depth;
+    uint64_t queued;
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    atomic64_t inlined;
+} fib_sched;
+
+static bool fib_mem_get(uint64_t mem)
+{
+    bool ok;
+    spin_lock(&fib_sched.lock);
+    ok = fib_sched.mem + mem <= READ_ONCE(sched_mem);
+    if (ok)
+        fib_sched.mem += mem;
+    spin_unlock(&fib_sched.lock);
+    return ok;
+}
+
+static void fib_mem_put(uint64_t mem)
+{
+    spin_lock(&fib_sched.lock);
+    fib_sched.mem -= mem;
+    spin_unlock(&fib_sched.lock);
+    wake_up(&fib_sched.mem_wait);
+}
+
+/* a request leaves the queue after waiting @ns, @started if a worker took it */
+static void fib_sched_dequeue(uint64_t ns, bool started)
+{
+    spin_lock(&fib_sched.lock);
+    fib_sched.depth--;
+    if (started) {
+        fib_sched.queued++;
+        fib_sched.wait_ns += ns;
+        fib_sched.max_wait_ns = MAX(fib_sched.max_wait_ns, ns);
+    }
+    spin_unlock(&fib_sched.lock);
+}
+
+static void fib_job_work(struct work_struct *work)
 {
-    if (!mutex_trylock(&fib_mutex)) {
-        printk(KERN_ALERT "fibdrv is in use");
-        return -EBUSY;
+    struct fib_job *job = container_of(work, struct fib_job, work);
+    fib_sched_dequeue(ktime_get_ns() - job->queued, true);
+    job->rc = job->fn(job);
+    complete(&job->done);
+}
+
+/* Run @job inline if the result takes at most @inline_limbs chunks, so the
+ * small queries never queue behind large ones. Otherwise hand it to the
+ * workers and wait.
+ */
+static int fib_schedule(struct fib_job *job, bool decimal)
+{
+    if (fib_limbs(job->k) <= READ_ONCE(inline_limbs)) {
+        atomic64_inc(&fib_sched.inlined);
+        return job->fn(job);
+    }
+    const uint64_t mem = fib_mem_cost(job->k, decimal);
+    if (unlikely(mem > READ_ONCE(sched_mem)))
+        return -E2BIG;
+
+    job->queued = ktime_get_ns();
+    spin_lock(&fib_sched.lock);
+    fib_sched.depth++;
+    fib_sched.max_depth = MAX(fib_sched.max_depth, fib_sched.depth);
+    spin_unlock(&fib_sched.lock);
+    if (wait_event_killable(fib_sched.mem_wait, fib_mem_get(mem))) {
+        fib_sched_dequeue(0, false);
+        return -EINTR;
     }
+    INIT_WORK_ONSTACK(&job->work, fib_job_work);
+    init_completion(&job->done);
+    queue_work(fib_sched.wq, &job->work);
+    /* the job checks for our fatal signals, so it ends soon after one */
+    if (wait_for_completion_killable(&job->done))
+        wait_for_completion(&job->done);
+    destroy_work_on_stack(&job->work);
+    fib_mem_put(mem);
+    return job->rc;
+}
+
+#if KSPACE
+#define FIB_STAT_ATTR(name, val)                                      \
+    static ssize_t name##_show(struct device *dev,                    \
+                               struct device_attribute *attr,         \
+                               char *buf)                             \
+    {                                                                 \
+        return sysfs_emit(buf, "%llu\n", (unsigned long long) (val)); \
+    }                                                                 \
+    static DEVICE_ATTR_RO(name)
+
+/* a member of fib_sched, read under its lock so 64-bit ones don't tear */
+#define fib_sched_read(member)        \
+    ({                                \
+        typeof(fib_sched.member) _v;  \
+        spin_lock(&fib_sched.lock);   \
+        _v = fib_sched.member;        \
+        spin_unlock(&fib_sched.lock); \
+        _v;                           \
+    })
+
+FIB_STAT_ATTR(inlined, atomic64_read(&fib_sched.inlined));
+FIB_STAT_ATTR(queued, fib_sched_read(queued));
+FIB_STAT_ATTR(depth, fib_sched_read(depth));
+FIB_STAT_ATTR(max_depth, fib_sched_read(max_depth));
+FIB_STAT_ATTR(wait_ns, fib_sched_read(wait_ns));
+FIB_STAT_ATTR(max_wait_ns, fib_sched_read(max_wait_ns));
+FIB_STAT_ATTR(mem, fib_sched_read(mem));
+FIB_STAT_ATTR(checked, atomic64_read(&fib_verify_checked));
+FIB_STAT_ATTR(failed, atomic64_read(&fib_verify_failed));
+
+static struct attribute *fib_sched_attrs[] = {
+    &dev_attr_inlined.attr,
+    &dev_attr_queued.attr,
+    &dev_attr_depth.attr,
+    &dev_attr_max_depth.attr,
+    &dev_attr_wait_ns.attr,
+    &dev_attr_max_wait_ns.attr,
+    &dev_attr_mem.attr,
+    NULL,
+};
+
+/* /sys/class/fibonacci/fibonacci/sched/ */
+static const struct attribute_group fib_sched_group = {
+    .name = "sched",
+    .attrs = fib_sched_attrs,
+};
+
+static struct attribute *fib_verify_attrs[] = {
+    &dev_attr_checked.attr,
+    &dev_attr_failed.attr,
+    NULL,
+};
+
+/* /sys/class/fibonacci/fibonacci/verify/ */
+static const struct attribute_group fib_verify_group = {
+    .name = "verify",
+    .attrs = fib_verify_attrs,
+};
+
+/* Crossovers of the algorithms, timed at load and writable. Writing to
+ * autotune times them again.
+ */
+#define FIB_TUNE_ATTR(name, var)                               \
+    static ssize_t name##_show(struct device *dev,             \
+                               struct device_attribute *attr,  \
+                               char *buf)                      \
+    {                                                          \
+        return sysfs_emit(buf, "%u\n", READ_ONCE(var));        \
+    }                                                          \
+    static ssize_t name##_store(struct device *dev,            \
+                                struct device_attribute *attr, \
+                                const char *buf,               \
+                                size_t count)                  \
+    {                                                          \
+        unsigned int v;                                        \
+        int rc = kstrtouint(buf, 0, &v);                       \
+        if (rc)                                                \
+            return rc;                                         \
+        WRITE_ONCE(var, v);                                    \
+        return count;                                          \
+    }                                                          \
+    static DEVICE_ATTR_RW(name)
+
+FIB_TUNE_ATTR(comba_max, ubn_comba_max);
+FIB_TUNE_ATTR(simd_min, ubn_simd_threshold);
+FIB_TUNE_ATTR(conv_large_min, ubn_2decimal_large_min);
+
+static DEFINE_MUTEX(fib_tune_lock);
+
+static void fib_tune(void)
+{
+    mutex_lock(&fib_tune_lock);
+    ubn_limb_tune();
+    ubignum_2decimal_tune();
+    mutex_unlock(&fib_tune_lock);
+}
+
+static ssize_t autotune_store(struct device *dev,
+                              struct device_attribute *attr,
+                              const char *buf,
+                              size_t count)
+{
+    fib_tune();
+    return count;
+}
+static DEVICE_ATTR_WO(autotune);
+
+static struct attribute *fib_tune_attrs[] = {
+    &dev_attr_comba_max.attr,
+    &dev_attr_simd_min.attr,
+    &dev_attr_conv_large_min.attr,
+    &dev_attr_autotune.attr,
+    NULL,
+};
+
+/* /sys/class/fibonacci/fibonacci/tune/ */
+static const struct attribute_group fib_tune_group = {
+    .name = "tune",
+    .attrs = fib_tune_attrs,
+};
+
+static const struct attribute_group *fib_groups[] = {
+    &fib_sched_group,
+    &fib_verify_group,
+    &fib_tune_group,
+    NULL,
+};
+
+#endif
+
+static int fib_open(struct inode *inode, struct file *file)
+{
+    /* no budget until FIB_IOC_BUDGET */
+    struct fib_file *f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (unlikely(!f))
+        return -ENOMEM;
+    spin_lock_init(&f->lock);
+#if KSPACE
+    mutex_init(&f->mutex);
+    f->k = -1;
+#endif
+    file->private_data = f;
     return 0;
 }
 
 static int fib_release(struct inode *inode, struct file *file)
 {
-    mutex_unlock(&fib_mutex);
+    struct fib_file *f = file->private_data;
+#if KSPACE
+    FREE(f->owned);
+    mutex_destroy(&f->mutex);
+#endif
+    kfree(f);
+    return 0;
+}
+
+/* Render F(k) in decimal with its terminating '\0'.
+ * *str points to *len chars, which are either in fib_table or in *owned,
+ * which the caller frees.
+ */
+static int fib_render(loff_t k,
+                      const char **str,
+                      size_t *len,
+                      char **owned,
+                      struct fib_ctx *ctx)
+{
+    *owned = NULL;
+    if (k < FIB_TABLE_SIZE) {
+        *str = fib_table.str + fib_table.off[k];
+        *len = fib_table.off[k + 1] - fib_table.off[k];
+        return 0;
+    }
+    if (unlikely(!fib_admit(k, true)))
+        return -E2BIG;
+    struct fib_job job = {.ctx = ctx,
+                          .fn = fib_job_render,
+                          .k = k,
+                          .engine = READ_ONCE(read_engine)};
+    int rc = fib_schedule(&job, true);
+    if (unlikely(rc))
+        return rc;
+    *str = *owned = job.str;
+    *len = job.len;
     return 0;
 }
 
@@ -120,16 +663,74 @@ static ssize_t fib_read(struct file *file,
                         size_t size,
                         loff_t *offset)
 {
-    ubn_t *N = fib_fast(*offset);
-    char *s = ubignum_2decimal(N);
-    ubignum_free(N);
-    int len = strlen(s) + 1;
-    if (copy_to_user(buf, s, len))
-        return -EFAULT;
-    kfree(s);
-    return (ssize_t) len;
+    const char *str;
+    char *owned;
+    size_t len;
+    struct fib_ctx ctx;
+    fib_ctx_init(&ctx, file);
+    int rc = fib_render(*offset, &str, &len, &owned, &ctx);
+    if (unlikely(rc))
+        return rc;
+    ssize_t ret;
+    if (unlikely(len > size))
+        ret = -EINVAL;
+    else
+        ret = copy_to_user(buf, str, len) ? -EFAULT : (ssize_t) len;
+    FREE(owned);
+    return ret;
 }
 
+#if KSPACE
+/* Same as fib_read(), for splice_read() to fill the pages of a pipe.
+ * F(k) is rendered once and kept in the file, then sent in pieces as large as
+ * @to takes, so that sendfile() streams results larger than the pipe. It
+ * returns 0 once all is sent. The position stays at k, where read() still
+ * gives F(k), and sending F(k) again takes a seek.
+ */
+static ssize_t fib_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct fib_file *f = iocb->ki_filp->private_data;
+    if (mutex_lock_killable(&f->mutex))
+        return -EINTR;
+    spin_lock(&f->lock);
+    const bool rewind = f->rewind;
+    f->rewind = false;
+    spin_unlock(&f->lock);
+
+    ssize_t ret = 0;
+    if (rewind || f->k != iocb->ki_pos) {
+        FREE(f->owned);
+        f->str = f->owned = NULL;
+        f->done = 0;
+        f->k = -1;
+        struct fib_ctx ctx;
+        fib_ctx_init(&ctx, iocb->ki_filp);
+        ret = fib_render(iocb->ki_pos, &f->str, &f->len, &f->owned, &ctx);
+        if (unlikely(ret))
+            goto out;
+        f->k = iocb->ki_pos;
+    }
+    if (f->str) {
+        const size_t n = MIN(f->len - f->done, iov_iter_count(to));
+        const size_t copied = copy_to_iter(f->str + f->done, n, to);
+        if (unlikely(n && !copied)) {
+            ret = -EFAULT;
+            goto out;
+        }
+        f->done += copied;
+        ret = copied;
+        /* only the end is kept, to tell the next call */
+        if (f->done == f->len) {
+            FREE(f->owned);
+            f->str = f->owned = NULL;
+        }
+    }
+out:
+    mutex_unlock(&f->mutex);
+    return ret;
+}
+#endif
+
 /* write operation is skipped */
 /* try to measure time within this function */
 static ssize_t fib_write(struct file *file,
@@ -137,24 +738,63 @@ static ssize_t fib_write(struct file *file,
                          size_t size,
                          loff_t *offset)
 {
-    ktime_t kt;
-    ubn_t *N = NULL;  // do not initialize
-    switch (size) {
-    case 0:
-        kt = ktime_get();
-        N = fib_sequence(*offset);
-        kt = ktime_sub(ktime_get(), kt);
-        break;
-    case 1:
-        kt = ktime_get();
-        N = fib_fast(*offset);
-        kt = ktime_sub(ktime_get(), kt);
-        break;
-    default:
+    struct fib_ctx ctx;
+    if (size >= FIB_ENGINE_MAX)
+        return 0;
+    if (unlikely(!fib_admit(*offset, false)))
+        return -E2BIG;
+    fib_ctx_init(&ctx, file);
+    struct fib_job job = {
+        .ctx = &ctx, .fn = fib_job_time, .k = *offset, .engine = size};
+    int rc = fib_schedule(&job, false);
+    return rc ? rc : (ssize_t) job.ns;
+}
+
+static long fib_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case FIB_IOC_MOD: {
+        struct fib_mod_req req;
+        if (copy_from_user(&req, (void __user *) arg, sizeof(req)))
+            return -EFAULT;
+        if (unlikely(!req.m))
+            return -EINVAL;
+        req.result = fib_mod(req.k, req.m);
+        if (copy_to_user((void __user *) arg, &req, sizeof(req)))
+            return -EFAULT;
         return 0;
     }
-    ubignum_free(N);
-    return (ssize_t) ktime_to_ns(kt);
+    case FIB_IOC_BUDGET: {
+        struct fib_budget budget;
+        if (copy_from_user(&budget, (void __user *) arg, sizeof(budget)))
+            return -EFAULT;
+        struct fib_file *f = file->private_data;
+        spin_lock(&f->lock);
+        f->budget = budget;
+        spin_unlock(&f->lock);
+        return 0;
+    }
+    case FIB_IOC_DIGITS: {
+        struct fib_digits_req req;
+        if (copy_from_user(&req, (void __user *) arg, sizeof(req)))
+            return -EFAULT;
+        if (unlikely(!req.d || req.d > FIB_DIGITS_MAX || req.k >> 63))
+            return -EINVAL;
+        uint64_t m = 1;
+        for (uint32_t i = 0; i < req.d; i++)
+            m *= 10;
+        /* __u64 is unsigned long long, uint64_t may be unsigned long */
+        uint64_t count;
+        req.head = fib_head(req.k, req.d, &count);
+        req.count = count;
+        req.tail = fib_mod(req.k, m);
+        if (copy_to_user((void __user *) arg, &req, sizeof(req)))
+            return -EFAULT;
+        return 0;
+    }
+    default:
+        return -ENOTTY;
+    }
 }
 
 static loff_t fib_device_lseek(struct file *file, loff_t offset, int orig)
@@ -165,25 +805,44 @@ static loff_t fib_device_lseek(struct file *file, loff_t offset, int orig)
         new_pos = offset;
         break;
     case 1: /* SEEK_CUR: */
-        new_pos = file->f_pos + offset;
+        if (offset > MAX_LENGTH - file->f_pos)
+            new_pos = MAX_LENGTH;
+        else
+            new_pos = file->f_pos + offset;
         break;
     case 2: /* SEEK_END: */
-        new_pos = MAX_LENGTH - offset;
+        new_pos = offset < 0 ? MAX_LENGTH : MAX_LENGTH - offset;
         break;
     }
 
-    if (new_pos > MAX_LENGTH)
-        new_pos = MAX_LENGTH;  // max case
     if (new_pos < 0)
         new_pos = 0;        // min case
     file->f_pos = new_pos;  // This is what we'll use now
+#if KSPACE
+    struct fib_file *f = file->private_data;
+    spin_lock(&f->lock);
+    f->rewind = true;
+    spin_unlock(&f->lock);
+#endif
     return new_pos;
 }
 
 const struct file_operations fib_fops = {
     .owner = THIS_MODULE,
     .read = fib_read,
+#if KSPACE
+    .read_iter = fib_read_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+#endif
     .write = fib_write,
+    .unlocked_ioctl = fib_ioctl,
+#if KSPACE
+    .compat_ioctl = compat_ptr_ioctl,
+#endif
     .open = fib_open,
     .release = fib_release,
     .llseek = fib_device_lseek,
@@ -193,8 +852,36 @@ static int __init init_fib_dev(void)
 {
     int rc = 0;
 
-    mutex_init(&fib_mutex);
+    ubn_limb_init();
+    printk(KERN_INFO "fibdrv: using %s limb kernels\n", ubn_limb_ops.name);
+    if (ubn_simd_threshold)
+        printk(KERN_INFO "fibdrv: vectorized basecase from %u chunks\n",
+               ubn_simd_threshold);
+    if (!ubignum_cache_init())
+        printk(KERN_INFO "fibdrv: no slab caches, numbers use kmalloc\n");
+    ubignum_2decimal_tune();
+    printk(KERN_INFO "fibdrv: column products up to %u chunks, "
+                     "block conversion from %u chunks\n",
+           ubn_comba_max, ubn_2decimal_large_min);
+    rc = fib_table_init();
+    if (rc < 0) {
+        printk(KERN_ALERT "Failed to build the table of small results");
+        ubignum_cache_exit();
+        ubn_limb_exit();
+        return rc;
+    }
+
+    init_waitqueue_head(&fib_sched.mem_wait);
+    spin_lock_init(&fib_sched.lock);
+    fib_sched.wq =
+        alloc_workqueue("fibdrv", WQ_UNBOUND, MAX(sched_workers, 1u));
+    if (!fib_sched.wq) {
+        printk(KERN_ALERT "Failed to create the workqueue");
+        rc = -ENOMEM;
+        goto failed_wq;
+    }
 
+#if KSPACE
     // Let's register the device
     // This will dynamically allocate the major number
     rc = alloc_chrdev_region(&fib_dev, 0, 1, DEV_FIBONACCI_NAME);
@@ -203,7 +890,7 @@ static int __init init_fib_dev(void)
         printk(KERN_ALERT
                "Failed to register the fibonacci char device. rc = %i",
                rc);
-        return rc;
+        goto failed_region;
     }
 
     fib_cdev = cdev_alloc();
@@ -229,28 +916,43 @@ static int __init init_fib_dev(void)
         goto failed_class_create;
     }
 
-    if (!device_create(fib_class, NULL, fib_dev, NULL, DEV_FIBONACCI_NAME)) {
+    if (!device_create_with_groups(fib_class, NULL, fib_dev, NULL, fib_groups,
+                                   DEV_FIBONACCI_NAME)) {
         printk(KERN_ALERT "Failed to create device");
         rc = -4;
         goto failed_device_create;
     }
+#endif
     return rc;
+#if KSPACE
 failed_device_create:
     class_destroy(fib_class);
 failed_class_create:
     cdev_del(fib_cdev);
 failed_cdev:
     unregister_chrdev_region(fib_dev, 1);
+failed_region:
+    destroy_workqueue(fib_sched.wq);
+#endif
+failed_wq:
+    FREE(fib_table.str);
+    ubignum_cache_exit();
+    ubn_limb_exit();
     return rc;
 }
 
 static void __exit exit_fib_dev(void)
 {
-    mutex_destroy(&fib_mutex);
+#if KSPACE
     device_destroy(fib_class, fib_dev);
     class_destroy(fib_class);
     cdev_del(fib_cdev);
     unregister_chrdev_region(fib_dev, 1);
+#endif
+    destroy_workqueue(fib_sched.wq);
+    FREE(fib_table.str);
+    ubignum_cache_exit();
+    ubn_limb_exit();
 }
 
 module_init(init_fib_dev);
@@ -0,0 +1,305 @@
+#include "fibmod.h"
+#include "base.h"
+#include "ubignum.h"
+
+#if KSPACE
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+/* Montgomery context for an odd modulus q, R = 2 ** 64
+ * @q: the modulus
+ * @qinv: q ** -1 mod R
+ * @one: R mod q, that is, 1 in Montgomery form
+ */
+typedef struct {
+    uint64_t q;
+    uint64_t qinv;
+    uint64_t one;
+} mont_t;
+
+/* (hi, lo) = a * b */
+static inline void mul64(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+#if CPU64
+    ubn_extunit_t p = (ubn_extunit_t) a * b;
+    *hi = p >> 64;
+    *lo = (uint64_t) p;
+#else
+    uint64_t ll = (uint64_t)(uint32_t) a * (uint32_t) b;
+    uint64_t lh = (uint64_t)(uint32_t) a * (b >> 32);
+    uint64_t hl = (a >> 32) * (uint64_t)(uint32_t) b;
+    uint64_t hh = (a >> 32) * (b >> 32);
+    uint64_t mid = (ll >> 32) + (uint32_t) lh + (uint32_t) hl;
+    *lo = (mid << 32) | (uint32_t) ll;
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+/* inverse of an odd number modulo 2 ** 64 by Newton's iteration */
+static inline uint64_t inv64(uint64_t q)
+{
+    uint64_t x = q;  // correct in the lowest 3 bits
+    for (int i = 0; i < 5; i++)
+        x *= 2 - q * x;
+    return x;
+}
+
+static void mont_init(mont_t *ctx, uint64_t q)
+{
+    ctx->q = q;
+    ctx->qinv = inv64(q);
+    ctx->one = (0 - q) % q;
+}
+
+/* (hi, lo) * R ** -1 mod q, (hi, lo) < q * R is required */
+static inline uint64_t mont_redc(const mont_t *ctx, uint64_t hi, uint64_t lo)
+{
+    /* lo - m * q vanishes in the lower word, so only the higher words matter
+     * and the result lies in (-q, q).
+     */
+    uint64_t mh, ml;
+    mul64(lo * ctx->qinv, ctx->q, &mh, &ml);
+    return hi >= mh ? hi - mh : hi - mh + ctx->q;
+}
+
+static inline uint64_t mont_mult(const mont_t *ctx, uint64_t a, uint64_t b)
+{
+    uint64_t hi, lo;
+    mul64(a, b, &hi, &lo);
+    return mont_redc(ctx, hi, lo);
+}
+
+static inline uint64_t mod_add(uint64_t a, uint64_t b, uint64_t q)
+{
+    uint64_t s = a + b;
+    return (s < a || s >= q) ? s - q : s;
+}
+
+/* F(k) mod q for odd q > 1 */
+static uint64_t fib_mod_odd(uint64_t k, uint64_t q)
+{
+    mont_t ctx;
+    mont_init(&ctx, q);
+    if (k == 0)
+        return 0;
+    /* a = F(n - 1), b = F(n), in Montgomery form */
+    uint64_t a = 0, b = ctx.one;
+    for (uint64_t currbit = (uint64_t) 1 << (63 - __builtin_clzll(k));
+         currbit >>= 1;) {
+        /* F(2n - 1) = F(n - 1) ** 2 + F(n) ** 2
+         * F(2n) = F(n) * (2 * F(n - 1) + F(n))
+         */
+        uint64_t f2n1 =
+            mod_add(mont_mult(&ctx, a, a), mont_mult(&ctx, b, b), q);
+        uint64_t f2n = mont_mult(&ctx, b, mod_add(mod_add(a, a, q), b, q));
+        if (k & currbit) {
+            a = f2n;
+            b = mod_add(f2n1, f2n, q);
+        } else {
+            a = f2n1;
+            b = f2n;
+        }
+    }
+    return mont_redc(&ctx, 0, b);
+}
+
+/* F(k) mod 2 ** 64, the arithmetic wraps around by itself */
+static uint64_t fib_mod_pow2(uint64_t k)
+{
+    if (k == 0)
+        return 0;
+    uint64_t a = 0, b = 1;
+    for (uint64_t currbit = (uint64_t) 1 << (63 - __builtin_clzll(k));
+         currbit >>= 1;) {
+        uint64_t f2n1 = a * a + b * b;
+        uint64_t f2n = b * (2 * a + b);
+        if (k & currbit) {
+            a = f2n;
+            b = f2n1 + f2n;
+        } else {
+            a = f2n1;
+            b = f2n;
+        }
+    }
+    return b;
+}
+
+/* F(k) mod m without any allocation
+ * Write m = q * 2 ** s with odd q. F(k) mod q is computed in Montgomery form
+ * and F(k) mod 2 ** s by plain wrapping arithmetic, then they are merged by
+ * the Chinese remainder theorem. m must not be 0.
+ */
+uint64_t fib_mod(uint64_t k, uint64_t m)
+{
+    const int s = __builtin_ctzll(m);
+    const uint64_t q = m >> s;
+    const uint64_t rq = q > 1 ? fib_mod_odd(k, q) : 0;
+    if (!s)
+        return rq;
+    const uint64_t mask = ((uint64_t) 1 << s) - 1;
+    const uint64_t r2 = fib_mod_pow2(k) & mask;
+    /* x = rq + q * t with t = (r2 - rq) * q ** -1 mod 2 ** s */
+    const uint64_t t = ((r2 - rq) * inv64(q)) & mask;
+    return rq + q * t;
+}
+
+/* N mod q, N having @size limbs of base @base (mod q) in @data, LS:[0]
+ * q is odd and above 2 ** 63, so every limb is below 2 * q.
+ */
+static uint64_t mod_horner(const ubn_unit_t *data,
+                           uint32_t size,
+                           uint64_t base,
+                           uint64_t q)
+{
+    mont_t ctx;
+    mont_init(&ctx, q);
+    /* R ** 2 mod q, then the base in Montgomery form */
+    uint64_t bm = ctx.one;
+    for (int i = 0; i < 64; i++)
+        bm = mod_add(bm, bm, q);
+    bm = mont_mult(&ctx, base, bm);
+    uint64_t r = 0;
+    while (size--) {
+        const uint64_t d = data[size] >= q ? data[size] - q : data[size];
+        r = mod_add(mont_mult(&ctx, r, bm), d, q);
+    }
+    return r;
+}
+
+/* N mod q for odd q > 2 ** 63, in O(N->size) */
+uint64_t ubignum_mod(const ubn_t *N, uint64_t q)
+{
+    /* 2 ** UBN_UNIT_BIT mod q */
+    const uint64_t base = mod_add(UBN_UNIT_MAX % q, 1, q);
+    return mod_horner(N->data, N->size, base, q);
+}
+
+/* same as ubignum_mod() for a number in decimal limbs */
+uint64_t ubn_dec_mod(const ubn_dec_t *N, uint64_t q)
+{
+    return mod_horner(N->data, N->size, UBN_DEC_BASE % q, q);
+}
+
+/* binary floating point number of fixed precision, m * 2 ** e
+ * @m: mantissa, LS:[0], normalized so that the top bit of m[2] is set
+ * @e: exponent of the least significant bit of @m
+ */
+typedef struct {
+    uint64_t m[3];
+    int64_t e;
+} hfloat_t;
+
+/* truncated to 192 bits */
+static const hfloat_t hf_phi = {
+    {0x084113b5f9d13928u, 0xf9ce60302e76e41au, 0xcf1bbcdcbfa53e0au},
+    -191};
+static const hfloat_t hf_rsqrt5 = {
+    {0xda01b923294ec1dbu, 0x294a33804a57d35cu, 0xe4f92e2dff6ec9abu},
+    -193};
+static const hfloat_t hf_tenth = {
+    {0xccccccccccccccccu, 0xccccccccccccccccu, 0xccccccccccccccccu},
+    -195};
+
+/* log_10(2) in 64-bit fixed point */
+#define LOG10_2_Q64 0x4d104d427de7fbccu
+
+/* a * b, the product is truncated to the mantissa */
+static hfloat_t hf_mult(const hfloat_t *a, const hfloat_t *b)
+{
+    uint64_t p[6] = {0};
+    for (int i = 0; i < 3; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < 3; j++) {
+            uint64_t hi, lo;
+            mul64(a->m[i], b->m[j], &hi, &lo);
+            lo += carry;
+            hi += lo < carry;
+            p[i + j] += lo;
+            carry = hi + (p[i + j] < lo);
+        }
+        p[i + 3] = carry;
+    }
+    hfloat_t r;
+    r.e = a->e + b->e + 192;
+    if (!(p[5] >> 63)) {
+        /* the product of two normalized mantissas loses at most one bit */
+        for (int i = 5; i > 1; i--)
+            p[i] = p[i] << 1 | p[i - 1] >> 63;
+        r.e--;
+    }
+    r.m[0] = p[3];
+    r.m[1] = p[4];
+    r.m[2] = p[5];
+    return r;
+}
+
+/* x ** n for n >= 1 */
+static hfloat_t hf_pow(const hfloat_t *x, uint64_t n)
+{
+    hfloat_t r = *x;
+    for (uint64_t currbit = (uint64_t) 1 << (63 - __builtin_clzll(n));
+         currbit >>= 1;) {
+        r = hf_mult(&r, &r);
+        if (n & currbit)
+            r = hf_mult(&r, x);
+    }
+    return r;
+}
+
+/* the integer part of x, which must be below 2 ** 64 */
+static uint64_t hf_floor(const hfloat_t *x)
+{
+    if (x->e <= -192)
+        return 0;
+    return x->m[2] >> (-x->e - 128);
+}
+
+static uint32_t u64_width(uint64_t x)
+{
+    uint32_t w = 1;
+    while (x >= 10) {
+        x /= 10;
+        w++;
+    }
+    return w;
+}
+
+/* the leading @d digits of F(k), and the number of its digits in *count
+ * 1 <= d <= 18 and k < 2 ** 63 are required.
+ * F(k) fits in 64 bits for k < 94 and is computed exactly. Beyond that F(k)
+ * and phi ** k / sqrt(5) differ by less than 1, and the latter is evaluated
+ * in 192-bit floating point together with 10 ** -s, where s is the number of
+ * digits to drop. Every operation loses at most 2 ** -191 relatively and the
+ * constants are raised to powers below 2 ** 63, so about 38 digits hold.
+ */
+uint64_t fib_head(uint64_t k, uint32_t d, uint64_t *count)
+{
+    if (k < 94) {
+        uint64_t f = fib_mod_pow2(k);
+        *count = u64_width(f);
+        for (uint32_t w = *count; w > d; w--)
+            f /= 10;
+        return f;
+    }
+    hfloat_t v = hf_pow(&hf_phi, k);
+    v = hf_mult(&v, &hf_rsqrt5);
+    /* v has b bits, so it has at least floor((b - 1) * log_10(2)) + 1 digits,
+     * at most one more
+     */
+    const uint64_t b = (uint64_t) (v.e + 192);
+    uint64_t hi, lo;
+    mul64(b - 1, LOG10_2_Q64, &hi, &lo);
+    const uint64_t s = hi + 1 - d;
+    /* h = v / 10 ** s has d or d + 1 digits, below 2 ** 64 */
+    const hfloat_t t = hf_pow(&hf_tenth, s);
+    v = hf_mult(&v, &t);
+    uint64_t h = hf_floor(&v);
+    const uint32_t w = u64_width(h);
+    *count = s + w;
+    for (uint32_t i = w; i > d; i--)
+        h /= 10;
+    return h;
+}
@@ -0,0 +1,18 @@
+#ifndef __FIBMOD_H
+#define __FIBMOD_H
+
+#include "base.h"
+#include "ubignum.h"
+
+#if KSPACE
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+uint64_t fib_mod(uint64_t k, uint64_t m);
+uint64_t ubignum_mod(const ubn_t *N, uint64_t q);
+uint64_t ubn_dec_mod(const ubn_dec_t *N, uint64_t q);
+uint64_t fib_head(uint64_t k, uint32_t d, uint64_t *count);
+
+#endif
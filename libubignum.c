@@ -0,0 +1,327 @@
+#include "libubignum.h"
+#include "base.h"
+#include "fib_engine.h"
+#include "fib_store.h"
+#include "fibmod.h"
+#include "ubignum.h"
+#include "ubn_limb.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+/* state of one call, checked by the engines through fib_check()
+ * @poll: hook handed to the conversion, it comes first to find the context
+ * @deadline: ubn_clock() beyond which the call times out, 0 for none
+ * @work: chunk operations the computation may still spend
+ * @err: 0, or why the call was given up
+ */
+struct fib_ctx {
+    ubn_poll_t poll;
+    uint64_t deadline;
+    uint64_t work;
+    int err;
+};
+
+bool fib_check(struct fib_ctx *ctx, uint64_t work)
+{
+    if (!ctx)
+        return true;
+    if (unlikely(ctx->err))
+        return false;
+    if (unlikely(ctx->work < work ||
+                 (ctx->deadline && ubn_clock() > ctx->deadline)))
+        ctx->err = -ETIMEDOUT;
+    else
+        ctx->work -= work;
+    return !ctx->err;
+}
+
+static bool ubn_lib_poll(ubn_poll_t *p)
+{
+    return fib_check((struct fib_ctx *) p, 0);
+}
+
+static void ubn_lib_ctx_init(struct fib_ctx *ctx,
+                             const struct fib_budget *budget)
+{
+    ctx->poll.fn = ubn_lib_poll;
+    ctx->deadline =
+        budget && budget->time_ns ? ubn_clock() + budget->time_ns : 0;
+    ctx->work = budget && budget->work ? budget->work : UINT64_MAX;
+    ctx->err = 0;
+}
+
+static pthread_once_t ubn_lib_once = PTHREAD_ONCE_INIT;
+/* set in every thread that calls in, so that its blocks pooled by ubignum.c
+ * are released when it exits
+ */
+static pthread_key_t ubn_lib_key;
+
+static void ubn_lib_thread_exit(void *arg)
+{
+    ubignum_cache_exit();
+}
+
+static void ubn_lib_init(void)
+{
+    ubn_limb_init();
+    ubignum_2decimal_tune();
+    pthread_key_create(&ubn_lib_key, ubn_lib_thread_exit);
+}
+
+/* called first by every entry point */
+static void ubn_lib_enter(void)
+{
+    pthread_once(&ubn_lib_once, ubn_lib_init);
+    if (!pthread_getspecific(ubn_lib_key))
+        pthread_setspecific(ubn_lib_key, &ubn_lib_key);
+}
+
+/* whether the engines can hold F(k) at all */
+static inline bool ubn_lib_admit(uint64_t k)
+{
+    return fib_limbs(k) <= UINT32_MAX / 2;
+}
+
+/* the store of ubn_store_open(), NULL if none */
+static struct fib_store *ubn_lib_store;
+
+/* F(k) by fast doubling through the store: k itself is read from it, or else
+ * the ladder starts from the longest prefix of the bits of k in it, and the
+ * pair of k is added.
+ */
+static ubn_t *ubn_lib_fast(uint64_t k, struct fib_ctx *ctx, bool parallel)
+{
+    struct fib_store *store = ubn_lib_store;
+    if (!store || k < 2)
+        return fib_fast(k, ctx, parallel);
+
+    struct fib_pair p = {.n = 0};
+    for (int j = 0; k >> j > 1; j++) {
+        const struct fib_store_rec *rec = fib_store_find(store, k >> j);
+        if (!rec)
+            continue;
+        if (!j) {
+            ubn_t *N = ubignum_init(fib_capacity(k));
+            if (N && unlikely(!ubn_limbs_import(N, rec->limbs + rec->n[0],
+                                                rec->n[1]))) {
+                ubignum_free(N);
+                N = NULL;
+            }
+            return N;
+        }
+        p.f[0] = ubignum_init(fib_capacity(k));
+        p.f[1] = ubignum_init(fib_capacity(k));
+        if (likely(p.f[0] && p.f[1]) &&
+            likely(ubn_limbs_import(p.f[0], rec->limbs, rec->n[0]) &&
+                   ubn_limbs_import(p.f[1], rec->limbs + rec->n[0],
+                                    rec->n[1]))) {
+            p.n = k >> j;
+        } else {
+            ubignum_free(p.f[0]);
+            ubignum_free(p.f[1]);
+        }
+        break;
+    }
+    if (unlikely(!fib_fast_pair(k, &p, ctx, parallel)))
+        return NULL;
+    if (k >= FIB_STORE_MIN_K)
+        fib_store_add(store, k, p.f);
+    ubignum_free(p.f[0]);
+    return p.f[1];
+}
+
+/* F(k) by one of the binary engines, fast doubling through the store if
+ * @stored
+ */
+static ubn_t *ubn_lib_compute(uint64_t k,
+                              unsigned int engine,
+                              struct fib_ctx *ctx,
+                              bool stored)
+{
+    switch (engine) {
+    case FIB_ENGINE_SEQUENCE:
+        return fib_sequence(k, ctx);
+    case FIB_ENGINE_PARALLEL:
+        return stored ? ubn_lib_fast(k, ctx, true) : fib_fast(k, ctx, true);
+    case FIB_ENGINE_CARRY_SAVE:
+        return fib_sequence_red(k, ctx);
+    default:
+        return stored ? ubn_lib_fast(k, ctx, false) : fib_fast(k, ctx, false);
+    }
+}
+
+size_t ubn_fib_size(uint64_t k)
+{
+    /* the bounds of ubignum_digits_bound() and ubn_dec_digits_bound() */
+    const uint64_t bits = fib_fixmul(k, FIB_LOG2_PHI) + 1;
+    const uint64_t bin = fib_fixmul(bits, 1234u << 20) + 1;
+    const uint64_t dec = fib_digits(k) + UBN_DEC_EXP;
+    return MAX(bin, dec) + 1;
+}
+
+ssize_t ubn_fib_read(uint64_t k,
+                     unsigned int engine,
+                     char *buf,
+                     size_t size,
+                     const struct fib_budget *budget)
+{
+    ubn_lib_enter();
+    if (unlikely(engine >= FIB_ENGINE_MAX))
+        return -EINVAL;
+    if (unlikely(!ubn_lib_admit(k)))
+        return -E2BIG;
+    if (unlikely(size < ubn_fib_size(k)))
+        return -ENOSPC;
+    size = MIN(size, (size_t) UINT32_MAX);
+
+    struct fib_ctx ctx;
+    ubn_lib_ctx_init(&ctx, budget);
+    uint32_t len;
+    bool ok;
+    if (engine == FIB_ENGINE_DECIMAL) {
+        ubn_dec_t *D = fib_sequence_dec(k, &ctx);
+        if (unlikely(!D))
+            return ctx.err ? ctx.err : -ENOMEM;
+        ok = ubn_dec_2decimal_buf(D, buf, size, &len);
+        ubn_dec_free(D);
+    } else {
+        ubn_t *N = ubn_lib_compute(k, engine, &ctx, true);
+        if (unlikely(!N))
+            return ctx.err ? ctx.err : -ENOMEM;
+        ok = ubignum_2decimal_buf(N, buf, size, &len, &ctx.poll);
+        ubignum_free(N);
+    }
+    if (unlikely(!ok))
+        return ctx.err ? ctx.err : -ENOMEM;
+    return len + 1;
+}
+
+int64_t ubn_fib_time(uint64_t k,
+                     unsigned int engine,
+                     const struct fib_budget *budget)
+{
+    ubn_lib_enter();
+    if (unlikely(engine >= FIB_ENGINE_MAX))
+        return -EINVAL;
+    if (unlikely(!ubn_lib_admit(k)))
+        return -E2BIG;
+
+    struct fib_ctx ctx;
+    ubn_lib_ctx_init(&ctx, budget);
+    uint64_t t = ubn_clock();
+    if (engine == FIB_ENGINE_DECIMAL) {
+        ubn_dec_t *D = fib_sequence_dec(k, &ctx);
+        t = ubn_clock() - t;
+        if (unlikely(!D))
+            return ctx.err ? ctx.err : -ENOMEM;
+        ubn_dec_free(D);
+    } else {
+        ubn_t *N = ubn_lib_compute(k, engine, &ctx, false);
+        t = ubn_clock() - t;
+        if (unlikely(!N))
+            return ctx.err ? ctx.err : -ENOMEM;
+        ubignum_free(N);
+    }
+    return t;
+}
+
+ssize_t ubn_fib_limbs(uint64_t k,
+                      unsigned int engine,
+                      uint64_t *limbs,
+                      size_t n,
+                      const struct fib_budget *budget)
+{
+    ubn_lib_enter();
+    if (unlikely(engine >= FIB_ENGINE_MAX || engine == FIB_ENGINE_DECIMAL))
+        return -EINVAL;
+    if (unlikely(!ubn_lib_admit(k)))
+        return -E2BIG;
+
+    struct fib_ctx ctx;
+    ubn_lib_ctx_init(&ctx, budget);
+    ubn_t *N = ubn_lib_compute(k, engine, &ctx, true);
+    if (unlikely(!N))
+        return ctx.err ? ctx.err : -ENOMEM;
+    const size_t used = ubn_limbs_count(N);
+    if (unlikely(n < used)) {
+        ubignum_free(N);
+        return -ENOSPC;
+    }
+    ubn_limbs_export(N, limbs);
+    ubignum_free(N);
+    return used;
+}
+
+ssize_t ubn_2decimal(const uint64_t *limbs, size_t n, char *buf, size_t size)
+{
+    ubn_lib_enter();
+    while (n && !limbs[n - 1])
+        n--;
+    if (unlikely(n > UINT32_MAX / 4))
+        return -E2BIG;
+    const uint32_t chunks = n * (64 / UBN_UNIT_BIT);
+    ubn_t *N = ubignum_init(MAX(chunks, 1u));
+    if (unlikely(!N))
+        return -ENOMEM;
+    ubn_limbs_import(N, limbs, n);
+
+    uint32_t len;
+    ssize_t rc;
+    if (unlikely(size <= ubignum_digits_bound(N)))
+        rc = -ENOSPC;
+    else if (unlikely(!ubignum_2decimal_buf(
+                 N, buf, MIN(size, (size_t) UINT32_MAX), &len, NULL)))
+        rc = -ENOMEM;
+    else
+        rc = len + 1;
+    ubignum_free(N);
+    return rc;
+}
+
+int ubn_fib_mod(struct fib_mod_req *req)
+{
+    if (unlikely(!req->m))
+        return -EINVAL;
+    req->result = fib_mod(req->k, req->m);
+    return 0;
+}
+
+int ubn_fib_digits(struct fib_digits_req *req)
+{
+    if (unlikely(!req->d || req->d > FIB_DIGITS_MAX || req->k >> 63))
+        return -EINVAL;
+    uint64_t m = 1, count;
+    for (uint32_t i = 0; i < req->d; i++)
+        m *= 10;
+    /* __u64 is unsigned long long, uint64_t may be unsigned long */
+    req->head = fib_head(req->k, req->d, &count);
+    req->count = count;
+    req->tail = fib_mod(req->k, m);
+    return 0;
+}
+
+int ubn_store_open(const char *path, bool writable)
+{
+    ubn_lib_enter();
+    if (ubn_lib_store)
+        return -EBUSY;
+    return fib_store_map(&ubn_lib_store, path, writable);
+}
+
+void ubn_store_close(void)
+{
+    fib_store_unmap(ubn_lib_store);
+    ubn_lib_store = NULL;
+}
+
+ssize_t ubn_store_lookup(uint64_t k, const uint64_t **limbs)
+{
+    const struct fib_store_rec *rec =
+        ubn_lib_store ? fib_store_find(ubn_lib_store, k) : NULL;
+    if (!rec)
+        return -ENOENT;
+    *limbs = rec->limbs + rec->n[0];
+    return rec->n[1];
+}
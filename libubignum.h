@@ -0,0 +1,81 @@
+#ifndef __LIBUBIGNUM_H
+#define __LIBUBIGNUM_H
+
+/* libubignum: the engines of fibdrv in user space, called in-process
+ * Every function may be called from several threads at once. Results go to
+ * buffers of the caller, and failures are reported as negative errno values
+ * like the driver does.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "fib_ioctl.h"
+
+/* bytes that always hold F(k) in decimal with its terminating '\0' */
+size_t ubn_fib_size(uint64_t k);
+
+/* Write F(k) in decimal by one of the FIB_ENGINE_* to buf[0 : size] with its
+ * terminating '\0', and return the length including the '\0'.
+ * @budget may be NULL for no limit.
+ * -EINVAL: unknown engine
+ * -E2BIG: F(k) is beyond the limits of the engines
+ * -ENOSPC: @size is below ubn_fib_size(k)
+ * -ETIMEDOUT: @budget ran out
+ * -ENOMEM
+ */
+ssize_t ubn_fib_read(uint64_t k,
+                     unsigned int engine,
+                     char *buf,
+                     size_t size,
+                     const struct fib_budget *budget);
+
+/* Return the time in ns one of the FIB_ENGINE_* takes to compute F(k), the
+ * result being discarded, or a negative errno as ubn_fib_read().
+ */
+int64_t ubn_fib_time(uint64_t k,
+                     unsigned int engine,
+                     const struct fib_budget *budget);
+
+/* Write F(k) by a binary engine to limbs[0 : n], least significant first,
+ * and return the number of limbs used. FIB_ENGINE_DECIMAL is not binary and
+ * gives -EINVAL, too few limbs give -ENOSPC, the rest is as ubn_fib_read().
+ */
+ssize_t ubn_fib_limbs(uint64_t k,
+                      unsigned int engine,
+                      uint64_t *limbs,
+                      size_t n,
+                      const struct fib_budget *budget);
+
+/* Write limbs[0 : n], least significant first, in decimal to buf[0 : size]
+ * with its terminating '\0', and return the length including the '\0'.
+ * 20 bytes per limb and 2 more always suffice, -ENOSPC is returned
+ * otherwise.
+ */
+ssize_t ubn_2decimal(const uint64_t *limbs, size_t n, char *buf, size_t size);
+
+/* Map the result store at @path, a file that is created if missing and
+ * @writable. Then F(k) by fast doubling is read from the store if there, or
+ * else computed from the longest prefix of the bits of k found in it and, if
+ * @writable, added. Opening takes the same time for any size of the store.
+ * A single store is open at a time, and it is opened and closed while no
+ * other call is running.
+ * -EBUSY: a store is open already, or another process writes to this one
+ * -EINVAL: @path is no store of this machine
+ */
+int ubn_store_open(const char *path, bool writable);
+void ubn_store_close(void);
+
+/* Point @limbs at F(k) in the store, least significant first, and return the
+ * number of limbs, or -ENOENT if it isn't there. The limbs are read in place
+ * and stay valid until ubn_store_close().
+ */
+ssize_t ubn_store_lookup(uint64_t k, const uint64_t **limbs);
+
+/* the same as FIB_IOC_MOD and FIB_IOC_DIGITS, 0 or -EINVAL */
+int ubn_fib_mod(struct fib_mod_req *req);
+int ubn_fib_digits(struct fib_digits_req *req);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __LIST_H
+#define __LIST_H
+
+/* The part of the doubly linked list of <linux/list.h> used by the library,
+ * for the user space build.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef container_of
+#define container_of(ptr, type, member) \
+    ((type *) ((char *) (ptr) - offsetof(type, member)))
+#endif
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) \
+    {                        \
+        &(name), &(name)     \
+    }
+
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void __list_add(struct list_head *node,
+                              struct list_head *prev,
+                              struct list_head *next)
+{
+    next->prev = node;
+    node->next = next;
+    node->prev = prev;
+    prev->next = node;
+}
+
+/* insert @node right after @head */
+static inline void list_add(struct list_head *node, struct list_head *head)
+{
+    __list_add(node, head, head->next);
+}
+
+/* insert @node right before @head, that is, at the end of the list */
+static inline void list_add_tail(struct list_head *node,
+                                 struct list_head *head)
+{
+    __list_add(node, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = entry->prev = NULL;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+#define list_first_entry(ptr, type, member) \
+    list_entry((ptr)->next, type, member)
+
+#define list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#endif
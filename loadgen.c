@@ -0,0 +1,288 @@
+/* Multi-client load generator for /dev/fibonacci */
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fib_ioctl.h"
+
+#define FIB_DEV "/dev/fibonacci"
+
+
+enum mix { MIX_UNIFORM, MIX_ZIPF, MIX_SEQ };
+enum op { OP_READ, OP_WRITE, OP_MOD };
+
+static struct {
+    int workers;
+    int procs;      // fork processes instead of spawning threads
+    enum op op;
+    int engine;     // size passed to write(), selects the engine
+    uint64_t mod;   // modulus of OP_MOD
+    long requests;  // per worker
+    long max_k;
+    size_t bufsz;   // enough for the digits of F(max_k)
+    enum mix mix;
+    double zipf_s;
+    uint64_t seed;
+} conf = {
+    .workers = 4,
+    .procs = 0,
+    .op = OP_READ,
+    .engine = 1,
+    .mod = 0,
+    .requests = 1000,
+    .max_k = 1000,
+    .mix = MIX_UNIFORM,
+    .zipf_s = 1.0,
+    .seed = 0x9E3779B97F4A7C15u,
+};
+
+static int fd;
+static double *zipf_cdf;  // zipf_cdf[k] = P(X <= k)
+static uint64_t *lat;     // latency in ns, workers * requests entries
+static long *errs;        // failed requests, one counter per worker
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* xorshift64* */
+static inline uint64_t rand_next(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1Du;
+}
+
+static int zipf_init(void)
+{
+    zipf_cdf = malloc(sizeof(double) * (conf.max_k + 1));
+    if (!zipf_cdf)
+        return -1;
+    /* rank r (starting at 1) is mapped to index r - 1 */
+    double sum = 0;
+    for (long k = 0; k <= conf.max_k; k++)
+        zipf_cdf[k] = (sum += 1.0 / pow(k + 1, conf.zipf_s));
+    for (long k = 0; k <= conf.max_k; k++)
+        zipf_cdf[k] /= sum;
+    return 0;
+}
+
+static long zipf_next(uint64_t *s)
+{
+    double u = (rand_next(s) >> 11) * (1.0 / 9007199254740992.0);
+    long lo = 0, hi = conf.max_k;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (zipf_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static uint64_t next_k(int id, long i, uint64_t *s)
+{
+    const uint64_t range = (uint64_t) conf.max_k + 1;
+    switch (conf.mix) {
+    case MIX_ZIPF:
+        return zipf_next(s);
+    case MIX_SEQ:
+        return (range / conf.workers * id + i) % range;
+    case MIX_UNIFORM:
+    default:
+        return rand_next(s) % range;
+    }
+}
+
+static void *worker(void *arg)
+{
+    const int id = (int) (intptr_t) arg;
+    uint64_t s = conf.seed + id * 0x9E3779B97F4A7C15u;
+    uint64_t *const mylat = lat + id * conf.requests;
+    char *buf = malloc(conf.bufsz);
+    if (!buf) {
+        errs[id] = conf.requests;
+        return NULL;
+    }
+
+    for (long i = 0; i < conf.requests; i++) {
+        const uint64_t k = next_k(id, i, &s);
+        uint64_t t = now_ns();
+        /* pread/pwrite keep the offset private to this request, so the
+         * workers can share one open file description.
+         */
+        ssize_t ret;
+        switch (conf.op) {
+        case OP_WRITE:
+            ret = pwrite(fd, buf, conf.engine, k);
+            break;
+        case OP_MOD: {
+            struct fib_mod_req req = {.k = k, .m = conf.mod};
+            ret = ioctl(fd, FIB_IOC_MOD, &req);
+            break;
+        }
+        case OP_READ:
+        default:
+            ret = pread(fd, buf, conf.bufsz, k);
+        }
+        mylat[i] = now_ns() - t;
+        if (ret < 0)
+            errs[id]++;
+    }
+    free(buf);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void report(uint64_t elapsed)
+{
+    const long total = conf.workers * conf.requests;
+    long nerr = 0;
+    for (int i = 0; i < conf.workers; i++)
+        nerr += errs[i];
+    qsort(lat, total, sizeof(uint64_t), cmp_u64);
+
+    printf("workers     %d %s\n", conf.workers,
+           conf.procs ? "processes" : "threads");
+    printf("requests    %ld (%ld failed)\n", total, nerr);
+    printf("elapsed     %.3f s\n", elapsed / 1e9);
+    printf("throughput  %.1f req/s\n", total / (elapsed / 1e9));
+    const double pct[] = {50, 90, 99, 99.9};
+    for (size_t i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+        printf("p%-10g %lu ns\n", pct[i],
+               (unsigned long) lat[(long) (pct[i] / 100 * (total - 1))]);
+    printf("max         %lu ns\n", (unsigned long) lat[total - 1]);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-t workers] [-p] [-n requests] [-k max_k]\n"
+            "          [-m uniform|zipf|seq] [-s zipf_exponent] [-w engine]\n"
+            "          [-M modulus]\n"
+            "  -p  fork processes instead of threads\n"
+            "  -w  issue timed write(engine) instead of read()\n"
+            "  -M  issue FIB_IOC_MOD instead of read()\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:pn:k:m:s:w:M:")) != -1) {
+        switch (opt) {
+        case 't':
+            conf.workers = atoi(optarg);
+            break;
+        case 'p':
+            conf.procs = 1;
+            break;
+        case 'n':
+            conf.requests = atol(optarg);
+            break;
+        case 'k':
+            conf.max_k = strtol(optarg, NULL, 0);
+            break;
+        case 'm':
+            if (!strcmp(optarg, "uniform"))
+                conf.mix = MIX_UNIFORM;
+            else if (!strcmp(optarg, "zipf"))
+                conf.mix = MIX_ZIPF;
+            else if (!strcmp(optarg, "seq"))
+                conf.mix = MIX_SEQ;
+            else
+                usage(argv[0]);
+            break;
+        case 's':
+            conf.zipf_s = atof(optarg);
+            break;
+        case 'w':
+            conf.op = OP_WRITE;
+            conf.engine = atoi(optarg);
+            break;
+        case 'M':
+            conf.op = OP_MOD;
+            conf.mod = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (conf.workers <= 0 || conf.requests <= 0 || conf.max_k < 0 ||
+        (conf.op == OP_MOD && !conf.mod))
+        usage(argv[0]);
+    /* F(k) has at most k * log_10(phi) + 1 digits */
+    conf.bufsz = conf.op == OP_READ ? conf.max_k * 0.20898764 + 2 : 16;
+    if (conf.mix == MIX_ZIPF && zipf_init()) {
+        perror("Failed to build zipf table");
+        exit(1);
+    }
+
+    /* shared mappings so that forked workers report back to the parent */
+    const size_t lat_sz = sizeof(uint64_t) * conf.workers * conf.requests;
+    lat = mmap(NULL, lat_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+               -1, 0);
+    errs = mmap(NULL, sizeof(long) * conf.workers, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (lat == MAP_FAILED || errs == MAP_FAILED) {
+        perror("Failed to map result buffers");
+        exit(1);
+    }
+
+    fd = open(FIB_DEV, O_RDWR);
+    if (fd < 0) {
+        perror("Failed to open character device");
+        exit(1);
+    }
+
+    uint64_t start = now_ns();
+    if (conf.procs) {
+        for (int i = 0; i < conf.workers; i++) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                exit(1);
+            } else if (pid == 0) {
+                worker((void *) (intptr_t) i);
+                _exit(0);
+            }
+        }
+        while (wait(NULL) > 0)
+            ;
+    } else {
+        pthread_t *th = malloc(sizeof(pthread_t) * conf.workers);
+        for (int i = 0; i < conf.workers; i++)
+            pthread_create(&th[i], NULL, worker, (void *) (intptr_t) i);
+        for (int i = 0; i < conf.workers; i++)
+            pthread_join(th[i], NULL);
+        free(th);
+    }
+    report(now_ns() - start);
+
+    close(fd);
+    munmap(lat, lat_sz);
+    munmap(errs, sizeof(long) * conf.workers);
+    free(zipf_cdf);
+    return 0;
+}
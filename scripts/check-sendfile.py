@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+# sendfile() from /dev/fibonacci must give exactly one F(k) and its '\0', also
+# when F(k) is larger than the pipe sendfile() goes through, and must leave
+# the position at k for the next read()
+
+import os
+import sys
+import tempfile
+
+FIB_DEV = '/dev/fibonacci'
+
+if hasattr(sys, 'set_int_max_str_digits'):
+    sys.set_int_max_str_digits(0)
+
+
+def fib(k):
+    # fast doubling, the sequence takes too long for the larger k
+    a, b = 0, 1
+    for bit in bin(k)[2:]:
+        a, b = a * (2 * b - a), a * a + b * b
+        if bit == '1':
+            a, b = b, a + b
+    return a
+
+
+fd = os.open(FIB_DEV, os.O_RDONLY)
+# F(500000) has 104494 digits, more than the 64 KiB of a default pipe
+for k in [0, 1, 2, 100, 1000, 10000, 500000]:
+    expect = str(fib(k)).encode() + b'\0'
+    with tempfile.TemporaryFile() as out:
+        os.lseek(fd, k, os.SEEK_SET)
+        total = 0
+        while True:
+            n = os.sendfile(out.fileno(), fd, None, 65536)
+            if n <= 0:
+                break
+            total += n
+        out.seek(0)
+        got = out.read()
+    if got != expect:
+        print('sendfile f(%d) fail: %d bytes, expected %d' %
+              (k, len(got), len(expect)))
+        sys.exit(1)
+    got = os.read(fd, len(expect))
+    if got != expect:
+        print('read f(%d) after sendfile fail: %d bytes, expected %d' %
+              (k, len(got), len(expect)))
+        sys.exit(1)
+os.close(fd)
@@ -1,5 +1,7 @@
 #include "ubignum.h"
 #include "base.h"
+#include "ubn_limb.h"
+#include "ubn_simd.h"
 
 #if KSPACE
 #include <linux/compiler.h>
@@ -17,29 +19,144 @@
 #include "list.h"
 #endif
 
+/* remainder of a block of UBN_SUPERTEN_EXP digits */
 typedef struct {
     ubn_div_t *dit;
-    char str[UBN_SUPERTEN_EXP + 1];
     struct list_head list;
 } ubn_2dec_l2_t;
 
-static char *ubignum_2decimal_large(const ubn_t *N);
-static char *ubignum_2decimal_medium(const ubn_t *N);
-static void ubignum_2decimal_l1(ubn_div_t *const dit, char *const str);
-static void ubignum_2decimal_l2(ubn_2dec_l2_t *const node);
+static uint32_t ubignum_2decimal_large(const ubn_t *N,
+                                       char *str,
+                                       ubn_poll_t *poll);
+static uint32_t ubignum_2decimal_medium(const ubn_t *N, char *str);
+static uint32_t ubignum_2decimal_groups(ubn_div_t *const dit,
+                                        ubn_unit_t *const grp);
+static uint32_t ubignum_2decimal_emit(char *str,
+                                      const ubn_unit_t *grp,
+                                      uint32_t n,
+                                      bool lead,
+                                      uint32_t exp);
 static inline int ubignum_clz(const ubn_t *N);
-static void ubignum_mult_add(const ubn_t *restrict a,
-                             uint32_t offset,
-                             ubn_t *restrict *out);
 
+uint32_t ubn_2decimal_large_min = UBN_SUPERTEN_CHUNK * 2;
 
 
+/* chunks of each size class, the last one is UBN_CACHE_MAX */
+static const uint32_t ubn_cache_room[UBN_CACHE_CLASSES] = {4, 16, 64};
+
+#if KSPACE
+static struct kmem_cache *ubn_cache[UBN_CACHE_CLASSES];
+#else
+/* Freed blocks are kept in a per-thread list for each class, which needs no
+ * locking. The first word of a free block links to the next one.
+ */
+#define UBN_POOL_MAX 64
+static __thread struct {
+    void *head;
+    uint32_t count;
+} ubn_pool[UBN_CACHE_CLASSES];
+#endif
+
+static inline int ubn_cache_class(uint32_t room)
+{
+    for (int i = 0; i < UBN_CACHE_CLASSES; i++)
+        if (room <= ubn_cache_room[i])
+            return i;
+    return -1;
+}
+
+static inline size_t ubn_block_size(uint32_t room)
+{
+    return sizeof(ubn_t) + sizeof(ubn_unit_t) * room;
+}
+
+/* Create the slabs of the size classes. Without them, the classes fall back
+ * to kmalloc, so a failure here is not fatal.
+ */
+bool ubignum_cache_init(void)
+{
+#if KSPACE
+    static const char *const names[UBN_CACHE_CLASSES] = {"ubn_4", "ubn_16",
+                                                         "ubn_64"};
+    for (int i = 0; i < UBN_CACHE_CLASSES; i++) {
+        ubn_cache[i] =
+            kmem_cache_create(names[i], ubn_block_size(ubn_cache_room[i]), 0,
+                              SLAB_HWCACHE_ALIGN, NULL);
+        if (unlikely(!ubn_cache[i])) {
+            ubignum_cache_exit();
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+/* destroy the slabs, every number must have been freed
+ * In user space, the blocks pooled by the calling thread are released.
+ */
+void ubignum_cache_exit(void)
+{
+    for (int i = 0; i < UBN_CACHE_CLASSES; i++) {
+#if KSPACE
+        kmem_cache_destroy(ubn_cache[i]);
+        ubn_cache[i] = NULL;
+#else
+        while (ubn_pool[i].head) {
+            void *next = *(void **) ubn_pool[i].head;
+            FREE(ubn_pool[i].head);
+            ubn_pool[i].head = next;
+        }
+        ubn_pool[i].count = 0;
+#endif
+    }
+}
+
+/* a zeroed block of a header and @room chunks, @room is one of the class
+ * sizes if @cls is not -1
+ */
+static ubn_t *ubn_block_alloc(uint32_t room, int cls)
+{
+#if KSPACE
+    if (cls >= 0 && ubn_cache[cls])
+        return kmem_cache_zalloc(ubn_cache[cls], GFP_KERNEL);
+#else
+    if (cls >= 0 && ubn_pool[cls].head) {
+        ubn_t *N = ubn_pool[cls].head;
+        ubn_pool[cls].head = *(void **) N;
+        ubn_pool[cls].count--;
+        memset(N, 0, ubn_block_size(room));
+        return N;
+    }
+#endif
+    return (ubn_t *) CALLOC(1, ubn_block_size(room));
+}
+
+static void ubn_block_free(ubn_t *N)
+{
+    const int cls = ubn_cache_class(N->room);
+#if KSPACE
+    if (cls >= 0 && ubn_cache[cls]) {
+        kmem_cache_free(ubn_cache[cls], N);
+        return;
+    }
+#else
+    if (cls >= 0 && ubn_pool[cls].count < UBN_POOL_MAX) {
+        *(void **) N = ubn_pool[cls].head;
+        ubn_pool[cls].head = N;
+        ubn_pool[cls].count++;
+        return;
+    }
+#endif
+    FREE(N);
+}
+
 void ubignum_free(ubn_t *N)
 {
     if (!N)
         return;
-    FREE(N->data);
-    FREE(N);
+    if (N->data != N->chunk)
+        FREE(N->data);
+    ubn_block_free(N);
 }
 
 /* set the number to 0, that is, size = 0 */
@@ -74,50 +191,57 @@ static inline int ubignum_clz(const ubn_t *N)
 }
 
 /* Initialize a big number and set its value to 0
+ * The chunks are allocated with the header. Small capacities are rounded up
+ * to their size class.
  */
 ubn_t *ubignum_init(uint32_t capacity)
 {
-    ubn_t *N = (ubn_t *) MALLOC(sizeof(ubn_t));
+    const int cls = ubn_cache_class(capacity);
+    const uint32_t room = cls >= 0 ? ubn_cache_room[cls] : capacity;
+    ubn_t *N = ubn_block_alloc(room, cls);
     if (unlikely(!N))
         return NULL;
-    if (unlikely(
-            !(N->data = (ubn_unit_t *) CALLOC(sizeof(ubn_unit_t), capacity)))) {
-        FREE(N);
-        return NULL;
-    }
-    N->capacity = capacity;
+    N->data = N->chunk;
+    N->capacity = room;
     N->size = 0;
+    N->room = room;
     return N;
 }
 
 /*
  * Adjust capacity of *N.
  * If false is returned, (*N) remains unchanged.
- * Set (*N)->data to NULL if new_capacity is 0.
+ * The header never moves. @data goes back to the inline chunks whenever they
+ * are enough, otherwise it lives in a separate allocation.
  */
 bool ubignum_recap(ubn_t *N, uint32_t new_capacity)
 {
-    if (unlikely(!new_capacity)) {
-        FREE(N->data);
-        N->data = NULL;
-        N->capacity = 0;
-        N->size = 0;
-        return true;
+    ubn_unit_t *new;
+    if (new_capacity <= N->room) {
+        new = N->chunk;
+        if (N->data != new) {
+            memcpy(new, N->data,
+                   sizeof(ubn_unit_t) * MIN(N->size, new_capacity));
+            FREE(N->data);
+        }
+        new_capacity = N->room;
+    } else if (N->data == N->chunk) {
+        new = (ubn_unit_t *) MALLOC(sizeof(ubn_unit_t) * new_capacity);
+        if (unlikely(!new))
+            return false;
+        memcpy(new, N->data, sizeof(ubn_unit_t) * N->size);
     } else {
-        ubn_unit_t *new =
-            (ubn_unit_t *) REALLOC(N->data, sizeof(ubn_unit_t) * new_capacity);
-        if (unlikely(!new)) {
-            FREE(new);
+        new = (ubn_unit_t *) REALLOC(N->data,
+                                     sizeof(ubn_unit_t) * new_capacity);
+        if (unlikely(!new))
             return false;
-        }
-        N->data = new;
-        if (new_capacity >= N->size)
-            memset(N->data + N->size, 0,
-                   (new_capacity - N->size) * sizeof(ubn_unit_t));
-        N->capacity = new_capacity;
-        N->size = MIN(N->size, N->capacity);
-        return true;
     }
+    N->data = new;
+    N->size = MIN(N->size, new_capacity);
+    memset(N->data + N->size, 0,
+           (new_capacity - N->size) * sizeof(ubn_unit_t));
+    N->capacity = new_capacity;
+    return true;
 }
 
 /* Compare two numbers
@@ -161,7 +285,8 @@ bool ubignum_left_shift(ubn_t *a, uint32_t d, ubn_t **out)
 
     const uint32_t chunk_shift = d / UBN_UNIT_BIT;
     const uint32_t shift = d % UBN_UNIT_BIT;
-    const uint32_t new_size = a->size + chunk_shift + (shift > ubignum_clz(a));
+    const uint32_t clz = ubignum_clz(a);  // @a is not zero
+    const uint32_t new_size = a->size + chunk_shift + (shift > clz);
     if (unlikely((*out)->capacity < new_size))
         if (unlikely(!ubignum_recap(*out, new_size)))
             return false;
@@ -172,7 +297,7 @@ bool ubignum_left_shift(ubn_t *a, uint32_t d, ubn_t **out)
      */
     if (shift) {
         int ai = a->size - 1, oi = a->size + chunk_shift - 1;
-        if (shift > ubignum_clz(a))
+        if (shift > clz)
             (*out)->data[oi + 1] = a->data[ai] >> (UBN_UNIT_BIT - shift);
         // merge the lower part from [ai] and the higher part from [ai - 1]
         for (; ai > 0; ai--)
@@ -196,6 +321,19 @@ bool ubignum_left_shift(ubn_t *a, uint32_t d, ubn_t **out)
  */
 bool ubignum_add(ubn_t *a, ubn_t *b, ubn_t **out)
 {
+    const uint32_t n = a->size;
+    if (n == b->size && n && n <= UBN_FIXED_MAX && (*out)->capacity > n) {
+        /* short operands of the same size, the carry-out lands in o[n] */
+        const uint32_t old_size = (*out)->size;
+        ubn_unit_t *const o = (*out)->data;
+        o[n] = ubn_add_fixed[n](o, a->data, b->data);
+        (*out)->size = o[n] ? n + 1 : n;
+        if (old_size > (*out)->size)
+            memset(o + (*out)->size, 0,
+                   sizeof(ubn_unit_t) * (old_size - (*out)->size));
+        return true;
+    }
+
     /* compute new size */
     uint32_t new_size;
     if (ubignum_iszero(a) || ubignum_iszero(b))
@@ -211,11 +349,9 @@ bool ubignum_add(ubn_t *a, ubn_t *b, ubn_t **out)
         if (unlikely(!ubignum_recap(*out, (*out)->capacity * 2)))
             return false;
 
-    if (*out != a && *out != b)  // if no pointer aliasing
-        ubignum_set_zero(*out);
-    int i = 0, carry = 0;
-    for (i = 0; i < MIN(a->size, b->size); i++)
-        carry = ubn_unit_add(a->data[i], b->data[i], carry, &(*out)->data[i]);
+    const uint32_t old_size = (*out)->size;
+    uint32_t i = MIN(a->size, b->size);
+    int carry = ubn_add_n((*out)->data, a->data, b->data, i);
     ubn_t *const remain = (i == a->size) ? b : a;
     for (; i < remain->size; i++)
         carry = ubn_unit_add(remain->data[i], 0, carry, &(*out)->data[i]);
@@ -224,6 +360,10 @@ bool ubignum_add(ubn_t *a, ubn_t *b, ubn_t **out)
         (*out)->data[i] = 1;
         (*out)->size++;
     }
+    /* keep the chunks beyond size zero, only the stale ones need clearing */
+    if (old_size > (*out)->size)
+        memset((*out)->data + (*out)->size, 0,
+               sizeof(ubn_unit_t) * (old_size - (*out)->size));
     return true;
 }
 
@@ -248,13 +388,13 @@ bool ubignum_sub(ubn_t *a, ubn_t *b, ubn_t **out)
                sizeof(ubn_unit_t) * ((*out)->size - a->size));
     }
 
-    // compute subtraction with adding the two's complement of @b
-    int carry = 1;
-    for (int i = 0; i < b->size; i++)
-        carry = ubn_unit_add(a->data[i], ~b->data[i], carry, &(*out)->data[i]);
-    for (int i = b->size; i < a->size; i++)
-        carry = ubn_unit_add(a->data[i], UBN_UNIT_MAX, carry, &(*out)->data[i]);
-    // the final carry is discarded
+    ubn_unit_t borrow = ubn_sub_n((*out)->data, a->data, b->data, b->size);
+    for (uint32_t i = b->size; i < a->size; i++) {
+        const ubn_unit_t ai = a->data[i];
+        (*out)->data[i] = ai - borrow;
+        borrow = ai < borrow;
+    }
+    // the final borrow is 0 since a > b
 
     (*out)->size = a->size;
     while ((*out)->data[(*out)->size - 1] == 0)
@@ -265,9 +405,10 @@ bool ubignum_sub(ubn_t *a, ubn_t *b, ubn_t **out)
 
 /* Division for unsigned big numbers
  * @dit must be initialized with ubn_div_init() before calling this
- * function.
+ * function. Every bit of the quotient costs a pass over @dit->dvd, so @poll,
+ * if not NULL, is called in between. Return false if it says so.
  */
-bool ubignum_div(ubn_div_t *dit, const ubn_t *restrict dvs)
+bool ubignum_div(ubn_div_t *dit, const ubn_t *restrict dvs, ubn_poll_t *poll)
 {
     ubignum_set_zero(dit->quo);
     ubignum_set_zero(dit->subed);
@@ -281,7 +422,10 @@ bool ubignum_div(ubn_div_t *dit, const ubn_t *restrict dvs)
     }
 
     dit->quo->size = dit->dvd->size - dvs->size + 1;
+    uint64_t work = 0;
     while (likely(ubignum_compare(dit->dvd, dvs) >= 0)) {  // if dvd >= dvs
+        if (unlikely(!ubn_poll_work(poll, &work, dit->dvd->size)))
+            return false;
         uint32_t shift =
             (dit->dvd->size * UBN_UNIT_BIT - ubignum_clz(dit->dvd)) -
             (dvs->size * UBN_UNIT_BIT - ubignum_clz(dvs));
@@ -351,33 +495,55 @@ void ubignum_divby_Lten(ubn_div_t *const dit)
     dit->sh_rmd = dit->dvd->data[0];  // \in [0, UBN_LTEN - 1]
 }
 
-/* (*out) += a << (offset * UBN_UNIT_BIT)
- * The capacity of (*out) must be guaranteed in mult(). No recap is done here!
+/* Prepare (*out) to be overwritten by a result of @size chunks.
+ * If (*out) is large enough and does not alias the operands, it is reused, so
+ * the products are computed in place. Otherwise a new number is returned and
+ * the caller has to replace (*out) with it.
+ * Only the chunks beyond @size are cleared, the caller has to write every one
+ * below.
  */
-static void ubignum_mult_add(const ubn_t *restrict a,
-                             uint32_t offset,
-                             ubn_t *restrict *out)
+static ubn_t *ubignum_mult_dest(const ubn_t *a,
+                                const ubn_t *b,
+                                uint32_t size,
+                                ubn_t **out)
 {
-    if (ubignum_iszero(a))
-        return;
-
-    int carry = 0, oi = offset;
-    for (int ai = 0; ai < a->size; ai++, oi++)
-        carry = ubn_unit_add((*out)->data[oi], a->data[ai], carry,
-                             &(*out)->data[oi]);
-    for (; carry; oi++)
-        carry = ubn_unit_add((*out)->data[oi], 0, carry, &(*out)->data[oi]);
-
-    (*out)->size = MAX(a->size + offset, (*out)->size);
-    for (int i = (*out)->size - 1; !(*out)->data[i]; i--)
-        (*out)->size--;
-    return;
+    if (*out != a && *out != b && (*out)->capacity >= size) {
+        if ((*out)->size > size)
+            memset((*out)->data + size, 0,
+                   sizeof(ubn_unit_t) * ((*out)->size - size));
+        (*out)->size = 0;
+        return *out;
+    }
+    return ubignum_init(size);
 }
 
+/* rp[0 : an + bn] = ap[0 : an] * bp[0 : bn] as ubn_mul_basecase(), calling
+ * @poll between the rows. Return false if it says so.
+ */
+static bool ubignum_mult_rows(ubn_unit_t *rp,
+                              const ubn_unit_t *ap,
+                              uint32_t an,
+                              const ubn_unit_t *bp,
+                              uint32_t bn,
+                              ubn_poll_t *poll)
+{
+    uint64_t work = 0;
+    rp[an] = ubn_mul_1(rp, ap, an, bp[0]);
+    for (uint32_t i = 1; i < bn; i++) {
+        if (unlikely(!ubn_poll_work(poll, &work, an)))
+            return false;
+        rp[i + an] = ubn_addmul_1(rp + i, ap, an, bp[i]);
+    }
+    return true;
+}
 
 /* *out = a * b
+ * No allocation is done if (*out) is not one of the operands and has enough
+ * capacity for a->size + b->size chunks.
+ * @poll, if not NULL, is called between the rows of long products. Return
+ * false on allocation failure or if it says so.
  */
-bool ubignum_mult(ubn_t *a, ubn_t *b, ubn_t **out)
+bool ubignum_mult(ubn_t *a, ubn_t *b, ubn_t **out, ubn_poll_t *poll)
 {
     if (ubignum_iszero(a) || ubignum_iszero(b)) {
         ubignum_set_zero(*out);
@@ -386,277 +552,748 @@ bool ubignum_mult(ubn_t *a, ubn_t *b, ubn_t **out)
     /* keep mcand longer than mplier */
     const ubn_t *mcand = a->size > b->size ? a : b;
     const ubn_t *mplier = a->size > b->size ? b : a;
-    ubn_t *ans = ubignum_init(mcand->size + mplier->size);
+    ubn_t *ans = ubignum_mult_dest(a, b, mcand->size + mplier->size, out);
     if (unlikely(!ans))
         return false;
-    ubn_t *pprod = ubignum_init(mcand->size + 1);  // partial product
-    if (unlikely(!pprod))
-        goto cleanup_ans;
-    pprod->size = mcand->size + 1;
 
-    /* Let a, b, c, d, e, f be chunks.
+    /* Short operands are scanned column by column, by the unrolled kernels
+     * if both have the same size up to UBN_FIXED_MAX. Mid-size ones may
+     * go to the vectorized basecase. Otherwise, the product is built by rows.
+     * Let a, b, c, d, e, f be chunks.
      * Suppose that we are going to mult (a, b, c, d) and (e, f).
-     * The outer loop goes from f to e and add the partial products.
+     * The outer loop goes from f to e and accumulates the partial products
+     * directly into @ans.
+     *          a   b   c   d
+     *    *                 f
+     * ---------------------------
+     *                 df  df       in the form of (high, low)
+     *             cf  cf
+     *         bf  bf
+     *  +  af  af
+     * ---------------------------
+     *         partial product
      */
-    for (int i = 0; i < mplier->size; i++) {
-        /* The inner loop do (a, b, c, d)*(e) and (a, b, c, d)*(f)
-         *          a   b   c   d
-         *    *                 f
-         * ---------------------------
-         *                 df  df       in the form of (high, low)
-         *             cf  cf
-         *         bf  bf
-         *  +  af  af
-         * ---------------------------
-         *            pprod
-         */
-        int carry = 0;
-        ubn_unit_t overlap = 0;
-        for (int j = 0; j < mcand->size; j++) {
-            ubn_unit_t low, high;
-            ubn_unit_mult(mcand->data[j], mplier->data[i], high, low);
-            carry = ubn_unit_add(low, overlap, carry, &pprod->data[j]);
-            overlap = high;  // update overlap
-        }
-        pprod->data[mcand->size] =
-            overlap + carry;  // no carry out would be generated
-
-        ubignum_mult_add(pprod, i, &ans);
+    if (mcand->size == mplier->size && mcand->size <= UBN_FIXED_MAX)
+        ubn_mul_fixed[mcand->size](ans->data, mcand->data, mplier->data);
+    else if (mcand->size <= ubn_comba_max)
+        ubn_mul_comba(ans->data, mcand->data, mcand->size, mplier->data,
+                      mplier->size);
+    else if ((!ubn_simd_wanted(mcand->size, mplier->size) ||
+              !ubn_simd_mult(ans->data, mcand->data, mcand->size, mplier->data,
+                             mplier->size)) &&
+             unlikely(!ubignum_mult_rows(ans->data, mcand->data, mcand->size,
+                                         mplier->data, mplier->size, poll))) {
+        if (ans != *out)
+            ubignum_free(ans);
+        return false;
+    }
+    ans->size = mcand->size + mplier->size;
+    if (!ans->data[ans->size - 1])
+        ans->size--;
+    if (ans != *out) {
+        ubignum_free(*out);
+        *out = ans;
     }
-    ubignum_free(pprod);
-    ubignum_free(*out);
-    *out = ans;
     return true;
-cleanup_ans:
-    ubignum_free(ans);
-    return false;
 }
 
-/* (*out) = a * a */
-bool ubignum_square(ubn_t *a, ubn_t **out)
+/* rp[0 : 2n] = ap[0 : n] ** 2, row by row, calling @poll in between
+ * Return false if it says so.
+ */
+static bool ubignum_square_rows(ubn_unit_t *rp,
+                                const ubn_unit_t *ap,
+                                uint32_t n,
+                                ubn_poll_t *poll)
 {
-    if (ubignum_iszero(a)) {
-        ubignum_set_zero(*out);
-        return true;
-    }
-    ubn_t *ans = ubignum_init(a->size * 2);
-    if (unlikely(!ans))
-        return false;
-    ubn_t *dprod = ubignum_init(a->size + 1 + 1);
-    if (unlikely(!dprod))
-        goto cleanup_ans;
-
     /*                  a   b   c   d
      *     *            a   b   c   d
      *    ------------------------------
-     *                 ad  bd  cd  dd       @dprod is (ad bd cd 0)
-     *             ac  bc  cc  cd                     (ac bc  0 0)
-     *         ab  bb  bc  bd                         (ab  0  0 0)
+     *                 ad  bd  cd  dd
+     *             ac  bc  cc  cd
+     *         ab  bb  bc  bd
      *     aa  ab  ac  ad
      *
      * Don't be messed by the sketch.
      * The entries usually have overlap, since multiplication doubles the
      * length. For exmaple, the dd occupies the two rightmost chunks.
      */
-    // compute aa, bb, cc, dd parts
-    for (int i = 0; i < a->size; i++)
-        ubn_unit_mult(a->data[i], a->data[i], ans->data[2 * i + 1],
-                      ans->data[2 * i]);
-    ans->size = ans->data[a->size * 2 - 1] ? a->size * 2 : a->size * 2 - 1;
-    // compute multiplications of different chunks
-    for (int i = 0; i < a->size - 1; i++) {
-        int carry = 0;
-        ubn_unit_t overlap = 0;
-        ubignum_set_zero(dprod);
-        for (int j = i + 1; j < a->size; j++) {
-            ubn_unit_t low, high;
-            ubn_unit_mult(a->data[j], a->data[i], high, low);
-            carry = ubn_unit_add(low, overlap, carry, &dprod->data[j]);
-            overlap = high;  // update overlap
-        }
-        dprod->data[a->size] =
-            overlap + carry;  // no carry-out would be generated
-        dprod->size = dprod->data[a->size] ? a->size + 1 : a->size;
-        ubignum_left_shift(dprod, 1, &dprod);  // * 2
-        ubignum_mult_add(dprod, i, &ans);
-    }
-    ubignum_free(dprod);
-    ubignum_free(*out);
-    *out = ans;
+    // compute multiplications of different chunks, that is, the upper half
+    rp[0] = 0;
+    rp[n * 2 - 1] = 0;
+    if (n > 1)
+        rp[n] = ubn_mul_1(rp + 1, ap + 1, n - 1, ap[0]);
+    uint64_t work = 0;
+    for (uint32_t i = 1; i + 1 < n; i++) {
+        if (unlikely(!ubn_poll_work(poll, &work, n - i)))
+            return false;
+        rp[i + n] = ubn_addmul_1(rp + 2 * i + 1, ap + i + 1, n - i - 1, ap[i]);
+    }
+    // double the upper half
+    ubn_unit_t msb = 0;
+    for (uint32_t i = 0; i < n * 2; i++) {
+        ubn_unit_t tmp = rp[i] >> (UBN_UNIT_BIT - 1);
+        rp[i] = rp[i] << 1 | msb;
+        msb = tmp;
+    }
+    // add aa, bb, cc, dd parts
+    int carry = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        ubn_unit_t low, high;
+        ubn_unit_mult(ap[i], ap[i], high, low);
+        carry = ubn_unit_add(rp[2 * i], low, carry, &rp[2 * i]);
+        carry = ubn_unit_add(rp[2 * i + 1], high, carry, &rp[2 * i + 1]);
+    }  // no carry-out would be generated
+    return true;
+}
+
+/* (*out) = a * a
+ * No allocation is done if (*out) is not @a and has enough capacity for
+ * 2 * a->size chunks. @poll is called as by ubignum_mult().
+ */
+bool ubignum_square(ubn_t *a, ubn_t **out, ubn_poll_t *poll)
+{
+    if (ubignum_iszero(a)) {
+        ubignum_set_zero(*out);
+        return true;
+    }
+    ubn_t *ans = ubignum_mult_dest(a, a, a->size * 2, out);
+    if (unlikely(!ans))
+        return false;
+
+    if (a->size <= UBN_FIXED_MAX)
+        ubn_sqr_fixed[a->size](ans->data, a->data);
+    else if (a->size <= ubn_comba_max)
+        ubn_sqr_comba(ans->data, a->data, a->size);
+    else if ((!ubn_simd_wanted(a->size, a->size) ||
+              !ubn_simd_mult(ans->data, a->data, a->size, a->data, a->size)) &&
+             unlikely(
+                 !ubignum_square_rows(ans->data, a->data, a->size, poll))) {
+        if (ans != *out)
+            ubignum_free(ans);
+        return false;
+    }
+    ans->size = a->size * 2;
+    if (!ans->data[ans->size - 1])
+        ans->size--;
+    if (ans != *out) {
+        ubignum_free(*out);
+        *out = ans;
+    }
     return true;
-cleanup_ans:
-    ubignum_free(ans);
+}
+
+/* rp[0 : ] += c
+ * The carry must stop within the allocated chunks.
+ */
+static inline void ubn_add_1(ubn_unit_t *rp, ubn_unit_t c)
+{
+    int carry = ubn_unit_add(*rp, c, 0, rp);
+    while (unlikely(carry)) {
+        rp++;
+        carry = ubn_unit_add(*rp, 0, carry, rp);
+    }
+}
+
+/* (*out) = 2 * a + b in a single pass
+ * Aliasing arguments are acceptable.
+ */
+bool ubignum_dbl_add(const ubn_t *a, const ubn_t *b, ubn_t **out)
+{
+    const uint32_t n = MAX(a->size, b->size);
+    if (unlikely((*out)->capacity < n + 1))
+        if (unlikely(!ubignum_recap(*out, n + 1)))
+            return false;
+
+    const uint32_t old_size = (*out)->size;
+    const uint32_t m = MIN(a->size, b->size);
+    ubn_unit_t *const o = (*out)->data;
+    ubn_unit_t msb = 0;
+    int carry = 0;
+    uint32_t i;
+    for (i = 0; i < m; i++) {
+        const ubn_unit_t ai = a->data[i];
+        carry = ubn_unit_add(ai << 1 | msb, b->data[i], carry, &o[i]);
+        msb = ai >> (UBN_UNIT_BIT - 1);
+    }
+    for (; i < a->size; i++) {
+        const ubn_unit_t ai = a->data[i];
+        carry = ubn_unit_add(ai << 1 | msb, 0, carry, &o[i]);
+        msb = ai >> (UBN_UNIT_BIT - 1);
+    }
+    for (; i < b->size; i++) {
+        carry = ubn_unit_add(msb, b->data[i], carry, &o[i]);
+        msb = 0;
+    }
+    o[n] = msb + carry;
+    (*out)->size = o[n] ? n + 1 : n;
+    if (old_size > (*out)->size)
+        memset(o + (*out)->size, 0,
+               sizeof(ubn_unit_t) * (old_size - (*out)->size));
+    return true;
+}
+
+/* (*out) = a * a + b * b
+ * The cross products of both operands are accumulated into one destination,
+ * which is then doubled once and gets both diagonals in one pass, instead of
+ * two squares and an addition.
+ * No allocation is done if (*out) is neither @a nor @b and has enough capacity
+ * for 2 * MAX(a->size, b->size) + 1 chunks. @poll is called as by
+ * ubignum_mult().
+ */
+bool ubignum_square_sum(ubn_t *a, ubn_t *b, ubn_t **out, ubn_poll_t *poll)
+{
+    if (ubignum_iszero(a))
+        return ubignum_square(b, out, poll);
+    else if (ubignum_iszero(b))
+        return ubignum_square(a, out, poll);
+    const uint32_t n = MAX(a->size, b->size);
+    ubn_t *ans = ubignum_mult_dest(a, b, n * 2 + 1, out);
+    if (unlikely(!ans))
+        return false;
+
+    ubn_unit_t *const o = ans->data;
+    memset(o, 0, sizeof(ubn_unit_t) * (n * 2 + 1));
+    // cross products, the sum of both is less than 2 ** (2n * UBN_UNIT_BIT)
+    uint64_t work = 0;
+    for (uint32_t i = 0; i + 1 < a->size; i++) {
+        if (unlikely(!ubn_poll_work(poll, &work, a->size - i)))
+            goto abort;
+        ubn_add_1(o + i + a->size, ubn_addmul_1(o + 2 * i + 1, a->data + i + 1,
+                                                a->size - i - 1, a->data[i]));
+    }
+    for (uint32_t i = 0; i + 1 < b->size; i++) {
+        if (unlikely(!ubn_poll_work(poll, &work, b->size - i)))
+            goto abort;
+        ubn_add_1(o + i + b->size, ubn_addmul_1(o + 2 * i + 1, b->data + i + 1,
+                                                b->size - i - 1, b->data[i]));
+    }
+    // double them
+    ubn_unit_t msb = 0;
+    for (uint32_t i = 0; i <= n * 2; i++) {
+        ubn_unit_t tmp = o[i] >> (UBN_UNIT_BIT - 1);
+        o[i] = o[i] << 1 | msb;
+        msb = tmp;
+    }
+    // add both diagonals with two independent carry chains
+    int ca = 0, cb = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        ubn_unit_t alow = 0, ahigh = 0, blow = 0, bhigh = 0;
+        if (i < a->size)
+            ubn_unit_mult(a->data[i], a->data[i], ahigh, alow);
+        if (i < b->size)
+            ubn_unit_mult(b->data[i], b->data[i], bhigh, blow);
+        ca = ubn_unit_add(o[2 * i], alow, ca, &o[2 * i]);
+        cb = ubn_unit_add(o[2 * i], blow, cb, &o[2 * i]);
+        ca = ubn_unit_add(o[2 * i + 1], ahigh, ca, &o[2 * i + 1]);
+        cb = ubn_unit_add(o[2 * i + 1], bhigh, cb, &o[2 * i + 1]);
+    }
+    o[n * 2] += ca + cb;  // no carry-out would be generated
+    ans->size = n * 2 + 1;
+    while (!o[ans->size - 1])
+        ans->size--;
+    if (ans != *out) {
+        ubignum_free(*out);
+        *out = ans;
+    }
+    return true;
+abort:
+    if (ans != *out)
+        ubignum_free(ans);
     return false;
 }
 
+/* upper bound of the number of decimal digits of N
+ * A number of b bits has at most floor(b * log_10(2)) + 1 digits, and
+ * 1234 / 4096 is slightly above log_10(2).
+ */
+uint32_t ubignum_digits_bound(const ubn_t *N)
+{
+    if (ubignum_iszero(N))
+        return 1;
+    const uint64_t bits = (uint64_t) UBN_UNIT_BIT * N->size - ubignum_clz(N);
+    return (uint32_t) ((bits * 1234) >> 12) + 1;
+}
+
 /* convert the unsigned big number to ascii string
  */
 char *ubignum_2decimal(const ubn_t *N)
 {
+    const uint32_t size = ubignum_digits_bound(N) + 1;
+    char *ans = (char *) MALLOC(sizeof(char) * size);
+    if (unlikely(!ans))
+        return NULL;
+    uint32_t len;
+    if (unlikely(!ubignum_2decimal_buf(N, ans, size, &len, NULL))) {
+        FREE(ans);
+        return NULL;
+    }
+    return ans;
+}
+
+/* Write N in decimal and a terminating '\0' to @buf, and the number of
+ * digits to *len.
+ * The digits are produced as groups of UBN_LTEN_EXP from the least
+ * significant, and written once at their final positions after the length of
+ * the leading group is known, so @buf needs ubignum_digits_bound(N) + 1
+ * chars. @poll, if not NULL, is called between the blocks of large numbers.
+ * Return false if @buf is shorter, on allocation failure or if @poll says so.
+ */
+bool ubignum_2decimal_buf(const ubn_t *N,
+                          char *buf,
+                          uint32_t size,
+                          uint32_t *len,
+                          ubn_poll_t *poll)
+{
+    if (unlikely(size <= ubignum_digits_bound(N)))
+        return false;
     if (ubignum_iszero(N)) {
-        char *ans = (char *) MALLOC(sizeof(char) * 2);
-        if (unlikely(!ans))
-            return NULL;
-        ans[0] = '0';
-        ans[1] = '\0';
-        return ans;
-    } else if (N->size == 1) {
-#if CPU64
-        char *ans = (char *) MALLOC(sizeof(char) * (20 + 1));
-#else
-        char *ans = (char *) MALLOC(sizeof(char) * (10 + 1));
-#endif
-        if (unlikely(!ans))
-            return NULL;
-#if CPU64
-        snprintf(ans, 20 + 1, "%llu", (unsigned long long) N->data[0]);
-#else
-        snprintf(ans, 10 + 1, "%u", (unsigned) N->data[0]);
-#endif
-        return ans;
+        buf[0] = '0';
+        buf[1] = '\0';
+        *len = 1;
+        return true;
+    }
+
+    uint32_t n;
+    if (N->size >= ubn_2decimal_large_min)
+        n = ubignum_2decimal_large(N, buf, poll);
+    else
+        n = ubignum_2decimal_medium(N, buf);
+    if (unlikely(!n))
+        return false;
+    buf[n] = '\0';
+    *len = n;
+    return true;
+}
+
+/* ubignum_2decimal_tune() tries sizes up to this, a conversion by groups of
+ * them takes milliseconds already
+ */
+#define UBN_2DEC_TUNE_MAX 512
+
+/* the best of a few conversions of N in ns */
+static uint64_t ubignum_2decimal_time(const ubn_t *N, char *str, bool large)
+{
+    uint64_t best = ~(uint64_t) 0;
+    for (int r = 0; r < 3; r++) {
+        uint64_t t = ubn_clock();
+        if (large)
+            ubignum_2decimal_large(N, str, NULL);
+        else
+            ubignum_2decimal_medium(N, str);
+        t = ubn_clock() - t;
+        best = MIN(best, t);
     }
+    return best;
+}
 
-    const uint32_t threshold = UBN_SUPERTEN_CHUNK * 2;
-    if (N->size >= threshold)
-        return ubignum_2decimal_large(N);
-    return ubignum_2decimal_medium(N);
+/* Time both conversions on numbers of doubling sizes,
+ * ubn_2decimal_large_min becomes the first size where splitting into blocks
+ * wins, or twice UBN_2DEC_TUNE_MAX if it never does.
+ */
+void ubignum_2decimal_tune(void)
+{
+    ubn_t *N = ubignum_init(UBN_2DEC_TUNE_MAX);
+    char *str = NULL;
+    if (unlikely(!N))
+        return;
+    uint64_t x = 0x9E3779B97F4A7C15u;
+    for (uint32_t i = 0; i < UBN_2DEC_TUNE_MAX; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        N->data[i] = (ubn_unit_t) x | 1;
+    }
+    N->size = UBN_2DEC_TUNE_MAX;
+    str = (char *) MALLOC(ubignum_digits_bound(N) + 1);
+    if (unlikely(!str))
+        goto cleanup;
+    uint32_t large_min = UBN_2DEC_TUNE_MAX * 2;
+    for (uint32_t n = 16; n <= UBN_2DEC_TUNE_MAX; n *= 2) {
+        N->size = n;
+        if (ubignum_2decimal_time(N, str, true) <
+            ubignum_2decimal_time(N, str, false)) {
+            large_min = n;
+            break;
+        }
+    }
+    ubn_2decimal_large_min = large_min;
+cleanup:
+    FREE(str);
+    ubignum_free(N);
 }
 
-static char *ubignum_2decimal_large(const ubn_t *N)
+/* N is split into blocks of UBN_SUPERTEN_EXP digits by dividing by
+ * 10 ** UBN_SUPERTEN_EXP. The most significant block decides the length, all
+ * the others are written in full width right after it.
+ */
+static uint32_t ubignum_2decimal_large(const ubn_t *N,
+                                       char *str,
+                                       ubn_poll_t *poll)
 {
+    LIST_HEAD(h);
+    uint32_t index = 0;
+    ubn_unit_t *grp = NULL;
+    ubn_t *super_ten = NULL;
     ubn_div_t *dit = ubn_div_init(N, (uint32_t) UBN_SUPERTEN_CHUNK);
+    if (unlikely(!dit))
+        return 0;
     /* obtain SUPERTEN from LTEN */
-    ubn_t *super_ten = ubignum_init(1);
+    super_ten = ubignum_init(1);
+    if (unlikely(!super_ten))
+        goto cleanup;
     ubignum_set_u64(super_ten, UBN_LTEN);
     for (uint32_t e = UBN_LTEN_EXP; e < UBN_SUPERTEN_EXP; e <<= 1)
-        ubignum_square(super_ten, &super_ten);
+        if (unlikely(!ubignum_square(super_ten, &super_ten, NULL)))
+            goto cleanup;
     /* divided by super_ten, which is 10 ** 1024 */
-    struct list_head *h = (struct list_head *) MALLOC(sizeof(struct list_head));
-    INIT_LIST_HEAD(h);
-    uint32_t list_len = 0;
     do {
-        ubignum_div(dit, super_ten);
+        if (unlikely(!ubignum_div(dit, super_ten, poll)))
+            goto cleanup;
         ubn_2dec_l2_t *l2node = (ubn_2dec_l2_t *) MALLOC(sizeof(ubn_2dec_l2_t));
+        if (unlikely(!l2node))
+            goto cleanup;
         l2node->dit = ubn_div_init(dit->dvd, 0);  // assigns remainder
-        l2node->str[UBN_SUPERTEN_EXP] = '\0';
-        list_add(&l2node->list, h);
-        list_len++;
+        if (unlikely(!l2node->dit)) {
+            FREE(l2node);
+            goto cleanup;
+        }
+        list_add(&l2node->list, &h);
         ubignum_swapptr(&dit->dvd, &dit->quo);
     } while (likely(!ubignum_iszero(dit->dvd)));
     ubn_div_free(dit);
     dit = NULL;
     ubignum_free(super_ten);
     super_ten = NULL;
-    char *ans =
-        (char *) MALLOC(sizeof(char) * (list_len * UBN_SUPERTEN_EXP + 1));
+
+    /* the most significant block comes first */
+    const uint32_t ngrp = UBN_SUPERTEN_EXP / UBN_LTEN_EXP;
+    grp = (ubn_unit_t *) MALLOC(sizeof(ubn_unit_t) * ngrp);
+    if (unlikely(!grp))
+        goto cleanup;
     struct list_head *it;
-    uint32_t index = 0;
-    bool start = false;
-    list_for_each (it, h) {
+    list_for_each (it, &h) {
+        if (unlikely(!ubn_poll(poll))) {
+            index = 0;
+            goto cleanup;
+        }
         ubn_2dec_l2_t *const l2node = list_entry(it, ubn_2dec_l2_t, list);
-        ubignum_2decimal_l2(l2node);
-        ubn_div_free(l2node->dit);
-        l2node->dit = NULL;
-        if (unlikely(!start)) {
-            uint32_t stridx = 0;
-            while (stridx < UBN_SUPERTEN_EXP &&
-                   likely(l2node->str[stridx] == '0'))
-                stridx++;
-            // stridx achieves end or stridx != '0'
-            if (l2node->str[stridx] != '\0') {
-                start = true;
-                memcpy(ans, l2node->str + stridx,
-                       sizeof(char) * (UBN_SUPERTEN_EXP - stridx));
-                index += UBN_SUPERTEN_EXP - stridx;
-            }
-        } else {
-            memcpy(ans + index, l2node->str, sizeof(char) * UBN_SUPERTEN_EXP);
-            index += UBN_SUPERTEN_EXP;
+        uint32_t n = ubignum_2decimal_groups(l2node->dit, grp);
+        const bool lead = !index;
+        if (!lead) {
+            memset(grp + n, 0, sizeof(ubn_unit_t) * (ngrp - n));
+            n = ngrp;
         }
+        index +=
+            ubignum_2decimal_emit(str + index, grp, n, lead, UBN_LTEN_EXP);
     }
-    ans[index] = '\0';
-    while (!list_empty(h)) {
-        ubn_2dec_l2_t *l2node = list_entry(h->next, ubn_2dec_l2_t, list);
+
+cleanup:
+    while (!list_empty(&h)) {
+        ubn_2dec_l2_t *l2node = list_entry(h.next, ubn_2dec_l2_t, list);
+        list_del(&l2node->list);
+        ubn_div_free(l2node->dit);
         FREE(l2node);
-        list_del(h->next);
     }
-    FREE(h);
-    h = NULL;
-    return ans;
-    // TODO: aloc fail handle
+    FREE(grp);
+    ubignum_free(super_ten);
+    ubn_div_free(dit);
+    return index;
 }
 
-static char *ubignum_2decimal_medium(const ubn_t *N)
+static uint32_t ubignum_2decimal_medium(const ubn_t *N, char *str)
 {
-    /* Estimate the digit needed.
-     * Let n be the number.
-     * digit = 1 + log_10(n) = 1 + \frac{log_2(n)}{log_2(10)}
-     * log_2(10) \approx 3.3219, we may choose 3.25
-     * (x * 13) >> 2 is equivalent to x / 3.25
-     */
-    uint64_t digit = (UBN_UNIT_BIT * N->size - ubignum_clz(N)) * 13;
-    digit = (digit >> 2) + 1;  // +1 for containing '\0'
+    /* at most (digits - 1) / UBN_LTEN_EXP + 1 groups */
+    const uint32_t ngrp = (ubignum_digits_bound(N) - 1) / UBN_LTEN_EXP + 1;
+    ubn_unit_t *grp = (ubn_unit_t *) MALLOC(sizeof(ubn_unit_t) * ngrp);
     ubn_div_t *dit = ubn_div_init(N, 0);
-    char *str = (char *) MALLOC(sizeof(char) * (digit + UBN_LTEN_EXP));
-    /* convert 2-base to 10-base */
-    uint32_t stridx = 0;
-    while (likely(!ubignum_iszero(dit->dvd))) {
-        ubignum_2decimal_l1(dit, str + stridx);
-        stridx += UBN_LTEN_EXP;
-    }
-    str[stridx] = '\0';
-    char *ans = (char *) MALLOC(sizeof(char) * (stridx + 1));
-    stridx -= UBN_LTEN_EXP;
-    uint32_t index = UBN_LTEN_EXP;
-    while (likely(str[stridx] == '0')) {
-        stridx++;
-        index--;
-    }
-    memcpy(ans, str + stridx, sizeof(char) * index);
-    stridx += index - UBN_LTEN_EXP - UBN_LTEN_EXP;
-    while (stridx) {
-        memcpy(ans + index, str + stridx, sizeof(char) * UBN_LTEN_EXP);
-        index += UBN_LTEN_EXP;
-        stridx -= UBN_LTEN_EXP;
-    }
-    memcpy(ans + index, str + stridx, sizeof(char) * UBN_LTEN_EXP);
-    index += UBN_LTEN_EXP;
-    ans[index] = '\0';
-    FREE(str);
+    uint32_t index = 0;
+    if (likely(grp && dit)) {
+        const uint32_t n = ubignum_2decimal_groups(dit, grp);
+        index = ubignum_2decimal_emit(str, grp, n, true, UBN_LTEN_EXP);
+    }
+    FREE(grp);
     ubn_div_free(dit);
-    dit = NULL;
-    return ans;
-    // TODO: aloc fail handle
+    return index;
 }
 
 /* no allocation
- * dit->dvd = dit->dvd / UBN_LTEN
- * copy the string format of (dit->dvd % UBN_LTEN) to str without '\0'
+ * Divide dit->dvd by UBN_LTEN until it is zero, store the remainders to
+ * @grp from the least significant, and return the number of them.
+ */
+static uint32_t ubignum_2decimal_groups(ubn_div_t *const dit,
+                                        ubn_unit_t *const grp)
+{
+    uint32_t n = 0;
+    while (likely(!ubignum_iszero(dit->dvd))) {
+        ubignum_divby_Lten(dit);
+        grp[n++] = dit->sh_rmd;
+        ubignum_swapptr(&dit->dvd, &dit->quo);
+    }
+    return n;
+}
+
+/* "00", "01", ..., "99", two digits at a time for the conversion */
+static const char ubn_digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* write the @width lower digits of @v to str[0 : width], padded with '0' */
+static inline void ubn_put_digits(char *str, uint32_t v, uint32_t width)
+{
+    while (width >= 2) {
+        width -= 2;
+        memcpy(str + width, ubn_digit_pairs + 2 * (v % 100), 2);
+        v /= 100;
+    }
+    if (width)
+        str[0] = '0' + v % 10;
+}
+
+/* number of digits of @v < 10 ** @exp, at least 1 */
+static inline uint32_t ubn_group_width(ubn_unit_t v, uint32_t exp)
+{
+    uint32_t w = 1;
+    for (ubn_unit_t p = 10; w < exp && v >= p; p *= 10)
+        w++;
+    return w;
+}
+
+/* write the @width lower digits of @v to str[0 : width]
+ * A 64-bit group is cut into pieces of 8 digits so the digit loop only
+ * divides 32-bit values.
  */
-static void ubignum_2decimal_l1(ubn_div_t *const dit, char *const str)
+static inline void ubn_put_group(char *str, ubn_unit_t v, uint32_t width)
 {
-    char s[UBN_LTEN_EXP + 1];
-    ubignum_divby_Lten(dit);
 #if CPU64
-    snprintf(s, UBN_LTEN_EXP + 1, "%0*llu", UBN_LTEN_EXP,
-             (unsigned long long) dit->sh_rmd);
-#else
-    snprintf(s, UBN_LTEN_EXP + 1, "%0*u", UBN_LTEN_EXP, (unsigned) rmd);
+    while (width > 8) {
+        width -= 8;
+        ubn_put_digits(str + width, (uint32_t) (v % 100000000u), 8);
+        v /= 100000000u;
+    }
 #endif
-    memcpy(str, s, sizeof(char) * UBN_LTEN_EXP);
-    ubignum_swapptr(&dit->dvd, &dit->quo);
+    ubn_put_digits(str, (uint32_t) v, width);
+}
+
+/* Write grp[n - 1], ..., grp[0] to @str without '\0', each one in @exp
+ * digits except grp[n - 1] when @lead, which has no leading zeros. Return
+ * the number of chars written.
+ */
+static uint32_t ubignum_2decimal_emit(char *str,
+                                      const ubn_unit_t *grp,
+                                      uint32_t n,
+                                      bool lead,
+                                      uint32_t exp)
+{
+    uint32_t index = 0;
+    if (lead && n) {
+        index = ubn_group_width(grp[--n], exp);
+        ubn_put_group(str, grp[n], index);
+    }
+    while (n--) {
+        ubn_put_group(str + index, grp[n], exp);
+        index += exp;
+    }
+    return index;
+}
+
+ubn_dec_t *ubn_dec_init(uint32_t capacity)
+{
+    ubn_dec_t *N = (ubn_dec_t *) MALLOC(sizeof(ubn_dec_t));
+    if (unlikely(!N))
+        return NULL;
+    capacity = MAX(capacity, 1u);
+    N->data = (ubn_unit_t *) CALLOC(capacity, sizeof(ubn_unit_t));
+    if (unlikely(!N->data)) {
+        FREE(N);
+        return NULL;
+    }
+    N->size = 0;
+    N->capacity = capacity;
+    return N;
+}
+
+void ubn_dec_free(ubn_dec_t *N)
+{
+    if (!N)
+        return;
+    FREE(N->data);
+    FREE(N);
+}
+
+/* N = v, @v must be below UBN_DEC_BASE */
+void ubn_dec_set(ubn_dec_t *N, ubn_unit_t v)
+{
+    memset(N->data, 0, sizeof(ubn_unit_t) * N->size);
+    N->data[0] = v;
+    N->size = !!v;
+}
+
+/* *out = a + b
+ * Aliasing arguments are acceptable. There is no recap, false is returned if
+ * @out can't hold the sum.
+ */
+bool ubn_dec_add(const ubn_dec_t *a, const ubn_dec_t *b, ubn_dec_t *out)
+{
+    if (a->size < b->size) {
+        const ubn_dec_t *t = a;
+        a = b;
+        b = t;
+    }
+    if (unlikely(out->capacity <= a->size))
+        return false;
+    const uint32_t old_size = out->size;
+    ubn_unit_t carry = 0;
+    uint32_t i = 0;
+    /* A limb sum is below 2 * UBN_DEC_BASE, which may wrap around the unit
+     * in base 10 ** 19. Subtracting the base then still gives the right limb.
+     */
+    for (; i < b->size; i++) {
+        ubn_unit_t s;
+        carry = ubn_unit_add(a->data[i], b->data[i], carry, &s);
+        carry |= s >= UBN_DEC_BASE;
+        out->data[i] = s - (UBN_DEC_BASE & -carry);
+    }
+    for (; i < a->size; i++) {
+        const ubn_unit_t s = a->data[i] + carry;
+        carry = s >= UBN_DEC_BASE;
+        out->data[i] = s - (UBN_DEC_BASE & -carry);
+    }
+    out->data[i] = carry;
+    out->size = i + carry;
+    if (old_size > out->size)
+        memset(out->data + out->size, 0,
+               sizeof(ubn_unit_t) * (old_size - out->size));
+    return true;
+}
+
+/* upper bound of the number of decimal digits of N */
+uint32_t ubn_dec_digits_bound(const ubn_dec_t *N)
+{
+    return N->size ? N->size * UBN_DEC_EXP : 1;
+}
+
+/* Same as ubignum_2decimal_buf(), the limbs are only formatted. */
+bool ubn_dec_2decimal_buf(const ubn_dec_t *N,
+                          char *buf,
+                          uint32_t size,
+                          uint32_t *len)
+{
+    if (unlikely(size <= ubn_dec_digits_bound(N)))
+        return false;
+    if (!N->size) {
+        buf[0] = '0';
+        buf[1] = '\0';
+        *len = 1;
+        return true;
+    }
+    *len = ubignum_2decimal_emit(buf, N->data, N->size, true, UBN_DEC_EXP);
+    buf[*len] = '\0';
+    return true;
+}
+
+ubn_red_t *ubn_red_init(uint32_t capacity)
+{
+    ubn_red_t *N = (ubn_red_t *) MALLOC(sizeof(ubn_red_t));
+    if (unlikely(!N))
+        return NULL;
+    capacity = MAX(capacity, 1u);
+    N->data = (ubn_unit_t *) CALLOC(capacity, sizeof(ubn_unit_t));
+    if (unlikely(!N->data)) {
+        FREE(N);
+        return NULL;
+    }
+    N->size = 0;
+    N->capacity = capacity;
+    return N;
+}
+
+void ubn_red_free(ubn_red_t *N)
+{
+    if (!N)
+        return;
+    FREE(N->data);
+    FREE(N);
+}
+
+/* N = v, @v must fit in UBN_RED_BIT bits */
+void ubn_red_set(ubn_red_t *N, ubn_unit_t v)
+{
+    memset(N->data, 0, sizeof(ubn_unit_t) * N->size);
+    N->data[0] = v;
+    N->size = !!v;
 }
 
-static void ubignum_2decimal_l2(ubn_2dec_l2_t *const node)
+/* a += b
+ * The limbs are added without carries, which the caller keeps within the
+ * headroom. If @carry, the bits of every sum beyond UBN_RED_BIT move to the
+ * next limb, so each limb ends up below 2 ** UBN_RED_BIT + 2 ** 8 again.
+ * No limb depends on the one below it, so both loops vectorize. The one that
+ * carries runs downwards to read the lower limb before it is overwritten.
+ * @a and @b must be distinct. There is no recap, false is returned if either
+ * can't hold the sum.
+ */
+bool ubn_red_add(ubn_red_t *a, const ubn_red_t *b, bool carry)
 {
-    uint16_t str_offset = UBN_SUPERTEN_EXP - UBN_LTEN_EXP;
-    while (likely(!ubignum_iszero(node->dit->dvd))) {
-        ubignum_2decimal_l1(node->dit, node->str + str_offset);
-        str_offset -= UBN_LTEN_EXP;
+    const uint32_t n = MAX(a->size, b->size);
+    if (unlikely(MIN(a->capacity, b->capacity) < n + carry))
+        return false;
+    ubn_unit_t *restrict ap = a->data;
+    const ubn_unit_t *restrict bp = b->data;
+    if (!carry) {
+        for (uint32_t i = 0; i < n; i++)
+            ap[i] += bp[i];
+        a->size = n;
+        return true;
     }
-    str_offset += UBN_LTEN_EXP;
-    if (unlikely(str_offset))
-        memset(node->str, '0', sizeof(char) * str_offset);  // pad '0'
+    /* ap[n] and bp[n] are zero */
+    for (uint32_t i = n; i > 0; i--)
+        ap[i] = ((ap[i] + bp[i]) & UBN_RED_MASK) +
+                ((ap[i - 1] + bp[i - 1]) >> UBN_RED_BIT);
+    ap[0] = (ap[0] + bp[0]) & UBN_RED_MASK;
+    a->size = n + !!ap[n];
+    return true;
+}
+
+/* Propagate the carries of N and store its value in @out.
+ * False is returned if @out can't hold it.
+ */
+bool ubn_red_2ubn(const ubn_red_t *N, ubn_t *out)
+{
+    /* the top limb may use the headroom as well */
+    const uint64_t bits = (uint64_t) N->size * UBN_RED_BIT + 8;
+    if (unlikely(out->capacity < (bits + UBN_UNIT_BIT - 1) / UBN_UNIT_BIT))
+        return false;
+    const uint32_t old_size = out->size;
+    ubn_extunit_t acc = 0;
+    ubn_unit_t carry = 0;
+    uint32_t nbits = 0, size = 0;
+    for (uint32_t i = 0; i < N->size; i++) {
+        const ubn_unit_t v = N->data[i] + carry;
+        carry = v >> UBN_RED_BIT;
+        acc |= (ubn_extunit_t)(v & UBN_RED_MASK) << nbits;
+        nbits += UBN_RED_BIT;
+        if (nbits >= UBN_UNIT_BIT) {
+            out->data[size++] = (ubn_unit_t) acc;
+            acc >>= UBN_UNIT_BIT;
+            nbits -= UBN_UNIT_BIT;
+        }
+    }
+    acc |= (ubn_extunit_t) carry << nbits;
+    nbits += UBN_UNIT_BIT - UBN_RED_BIT;
+    while (nbits) {
+        out->data[size++] = (ubn_unit_t) acc;
+        acc >>= UBN_UNIT_BIT;
+        nbits -= MIN(nbits, (uint32_t) UBN_UNIT_BIT);
+    }
+    while (size && !out->data[size - 1])
+        size--;
+    out->size = size;
+    if (old_size > size)
+        memset(out->data + size, 0, sizeof(ubn_unit_t) * (old_size - size));
+    return true;
 }
 
 /* Allocate space for members and copy dividend->data to ()->dvd->data.
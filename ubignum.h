@@ -24,13 +24,65 @@
  * @data: MS:[size-1], LS:[0]
  * @size: used size in @data divided by sizeof(ubn_unit_t)
  * @capacity: allocated size of @data
+ * @room: number of chunks allocated together with the header
+ * @chunk: storage of @data, until it grows beyond @room
  */
 typedef struct {
     ubn_unit_t *data;
     uint32_t size;
     uint32_t capacity;
+    uint32_t room;
+    ubn_unit_t chunk[];
 } ubn_t;
 
+/* unsigned big number in base UBN_DEC_BASE, for computations that only add
+ * and want decimal output, which is then only formatting of the limbs
+ * @data: MS:[size-1], LS:[0], each below UBN_DEC_BASE
+ * @size: used size in @data divided by sizeof(ubn_unit_t)
+ * @capacity: allocated size of @data
+ */
+typedef struct {
+    ubn_unit_t *data;
+    uint32_t size;
+    uint32_t capacity;
+} ubn_dec_t;
+
+/* unsigned big number in redundant form, for long runs of additions
+ * Every limb stands for UBN_RED_BIT bits but may exceed them, so additions
+ * have no carry chain and carries are moved up by one limb only when asked.
+ * @data: MS:[size-1], LS:[0], value is sum(data[i] << (i * UBN_RED_BIT))
+ * @size: used size in @data divided by sizeof(ubn_unit_t)
+ * @capacity: allocated size of @data, limbs from @size on are zero
+ */
+typedef struct {
+    ubn_unit_t *data;
+    uint32_t size;
+    uint32_t capacity;
+} ubn_red_t;
+
+/* Numbers of at most UBN_CACHE_MAX chunks take their header and chunks from
+ * one of a few size classes, kmem_cache slabs in the kernel and per-thread
+ * free lists in user space. Larger ones are a single allocation.
+ */
+#define UBN_CACHE_CLASSES 3
+#define UBN_CACHE_MAX 64
+
+/* Conversions of numbers of at least this many chunks split them into blocks
+ * of UBN_SUPERTEN_EXP digits first. ubignum_2decimal_tune() sets it for this
+ * machine.
+ */
+extern uint32_t ubn_2decimal_large_min;
+
+/* Hook that long operations call between their steps, they give up when
+ * @fn returns false. Embed it in a larger struct to carry the caller's state.
+ */
+typedef struct ubn_poll {
+    bool (*fn)(struct ubn_poll *p);
+} ubn_poll_t;
+
+/* chunk operations the long loops run between two calls of the hook */
+#define UBN_POLL_WORK (1u << 16)
+
 /* The struct that is used for ubignum_div().
  */
 typedef struct {
@@ -59,9 +111,13 @@ typedef struct {
     })
 #endif
 
+bool ubignum_cache_init(void);
+void ubignum_cache_exit(void);
 ubn_t *ubignum_init(uint32_t capacity);
 bool ubignum_recap(ubn_t *N, uint32_t new_capacity);
 void ubignum_free(ubn_t *N);
+static inline bool ubn_poll(ubn_poll_t *p);
+static inline bool ubn_poll_work(ubn_poll_t *p, uint64_t *work, uint64_t n);
 static inline void ubignum_swapptr(ubn_t **a, ubn_t **b);
 static inline int ubn_unit_add(ubn_unit_t a,
                                ubn_unit_t b,
@@ -74,10 +130,33 @@ int ubignum_compare(const ubn_t *a, const ubn_t *b);
 bool ubignum_left_shift(ubn_t *a, uint32_t d, ubn_t **out);
 bool ubignum_add(ubn_t *a, ubn_t *b, ubn_t **out);
 bool ubignum_sub(ubn_t *a, ubn_t *b, ubn_t **out);
-bool ubignum_mult(ubn_t *a, ubn_t *b, ubn_t **out);
-bool ubignum_square(ubn_t *a, ubn_t **out);
+bool ubignum_mult(ubn_t *a, ubn_t *b, ubn_t **out, ubn_poll_t *poll);
+bool ubignum_square(ubn_t *a, ubn_t **out, ubn_poll_t *poll);
+bool ubignum_dbl_add(const ubn_t *a, const ubn_t *b, ubn_t **out);
+bool ubignum_square_sum(ubn_t *a, ubn_t *b, ubn_t **out, ubn_poll_t *poll);
+uint32_t ubignum_digits_bound(const ubn_t *N);
 char *ubignum_2decimal(const ubn_t *N);
-bool ubignum_div(ubn_div_t *dit, const ubn_t *restrict dvs);
+bool ubignum_2decimal_buf(const ubn_t *N,
+                          char *buf,
+                          uint32_t size,
+                          uint32_t *len,
+                          ubn_poll_t *poll);
+void ubignum_2decimal_tune(void);
+bool ubignum_div(ubn_div_t *dit, const ubn_t *restrict dvs, ubn_poll_t *poll);
+ubn_dec_t *ubn_dec_init(uint32_t capacity);
+void ubn_dec_free(ubn_dec_t *N);
+void ubn_dec_set(ubn_dec_t *N, ubn_unit_t v);
+bool ubn_dec_add(const ubn_dec_t *a, const ubn_dec_t *b, ubn_dec_t *out);
+uint32_t ubn_dec_digits_bound(const ubn_dec_t *N);
+bool ubn_dec_2decimal_buf(const ubn_dec_t *N,
+                          char *buf,
+                          uint32_t size,
+                          uint32_t *len);
+ubn_red_t *ubn_red_init(uint32_t capacity);
+void ubn_red_free(ubn_red_t *N);
+void ubn_red_set(ubn_red_t *N, ubn_unit_t v);
+bool ubn_red_add(ubn_red_t *a, const ubn_red_t *b, bool carry);
+bool ubn_red_2ubn(const ubn_red_t *N, ubn_t *out);
 void ubignum_divby_Lten(ubn_div_t *const dit);
 
 ubn_div_t *ubn_div_init(const ubn_t *dividend, uint32_t dvs_level);
@@ -91,17 +170,32 @@ static inline int ubn_unit_add(ubn_unit_t a,
                                int cin,
                                ubn_unit_t *sum)
 {
-    int cout = 0;
-#if CPU64
-    cout = __builtin_uaddll_overflow(a, cin, sum);
-    cout |= __builtin_uaddll_overflow(*sum, b, sum);
-#else
-    cout = __builtin_uadd_overflow(a, cin, sum);
-    cout |= __builtin_uadd_overflow(*sum, b, sum);
-#endif
+    /* the type-generic builtins, since ubn_unit_t is unsigned long rather
+     * than unsigned long long in 64-bit user space
+     */
+    int cout = __builtin_add_overflow(a, (ubn_unit_t) cin, sum);
+    cout |= __builtin_add_overflow(*sum, b, sum);
     return cout;
 }
 
+/* true if the operation may go on, @p may be NULL */
+static inline bool ubn_poll(ubn_poll_t *p)
+{
+    return !p || p->fn(p);
+}
+
+/* Count @n more chunk operations in *work, and call ubn_poll() once they
+ * reach UBN_POLL_WORK.
+ */
+static inline bool ubn_poll_work(ubn_poll_t *p, uint64_t *work, uint64_t n)
+{
+    *work += n;
+    if (likely(*work < UBN_POLL_WORK))
+        return true;
+    *work = 0;
+    return ubn_poll(p);
+}
+
 /* swap two ubn_t */
 static inline void ubignum_swapptr(ubn_t **a, ubn_t **b)
 {
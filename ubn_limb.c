@@ -0,0 +1,459 @@
+#include "ubn_limb.h"
+#include "base.h"
+#include "ubignum.h"
+#include "ubn_simd.h"
+
+#if KSPACE
+#include <linux/types.h>
+#if defined(__x86_64__)
+#include <asm/cpufeature.h>
+#endif
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#endif
+
+static ubn_unit_t ubn_mul_1_generic(ubn_unit_t *rp,
+                                    const ubn_unit_t *ap,
+                                    uint32_t n,
+                                    ubn_unit_t b)
+{
+    ubn_unit_t overlap = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        ubn_unit_t low, high;
+        ubn_unit_mult(ap[i], b, high, low);
+        overlap = high + ubn_unit_add(low, overlap, 0, &rp[i]);
+    }
+    return overlap;
+}
+
+static ubn_unit_t ubn_addmul_1_generic(ubn_unit_t *rp,
+                                       const ubn_unit_t *ap,
+                                       uint32_t n,
+                                       ubn_unit_t b)
+{
+    ubn_unit_t overlap = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        ubn_unit_t low, high;
+        ubn_unit_mult(ap[i], b, high, low);
+        int carry = ubn_unit_add(low, overlap, 0, &low);
+        carry += ubn_unit_add(rp[i], low, 0, &rp[i]);
+        overlap = high + carry;  // no carry-out would be generated
+    }
+    return overlap;
+}
+
+static ubn_unit_t ubn_add_n_generic(ubn_unit_t *rp,
+                                    const ubn_unit_t *ap,
+                                    const ubn_unit_t *bp,
+                                    uint32_t n)
+{
+    int carry = 0;
+    for (uint32_t i = 0; i < n; i++)
+        carry = ubn_unit_add(ap[i], bp[i], carry, &rp[i]);
+    return carry;
+}
+
+static ubn_unit_t ubn_sub_n_generic(ubn_unit_t *rp,
+                                    const ubn_unit_t *ap,
+                                    const ubn_unit_t *bp,
+                                    uint32_t n)
+{
+    // add the two's complement of @bp
+    int carry = 1;
+    for (uint32_t i = 0; i < n; i++)
+        carry = ubn_unit_add(ap[i], ~bp[i], carry, &rp[i]);
+    return !carry;
+}
+
+/* (c2, c1, c0) += a * b, the three-chunk column accumulator */
+#if defined(__x86_64__)
+#define ubn_comba_mac(a, b, c0, c1, c2)                                    \
+    do {                                                                   \
+        ubn_unit_t _low = (a), _high;                                      \
+        __asm__("mulq %[m]\n\t"                                            \
+                "add %%rax, %[x0]\n\t"                                     \
+                "adc %%rdx, %[x1]\n\t"                                     \
+                "adc $0, %[x2]\n\t"                                        \
+                : [x0] "+r"(c0), [x1] "+r"(c1), [x2] "+r"(c2), "+a"(_low), \
+                  "=d"(_high)                                              \
+                : [m] "rm"(b)                                              \
+                : "cc");                                                   \
+    } while (0)
+#else
+#define ubn_comba_mac(a, b, c0, c1, c2)                \
+    do {                                               \
+        ubn_unit_t _low, _high;                        \
+        ubn_unit_mult(a, b, _high, _low);              \
+        int _carry = ubn_unit_add(c0, _low, 0, &c0);   \
+        _carry = ubn_unit_add(c1, _high, _carry, &c1); \
+        c2 += _carry;                                  \
+    } while (0)
+#endif
+
+/* The bodies below are forced inline, so that the fixed-size kernels
+ * instantiated with constant sizes get every loop unrolled.
+ */
+#define ubn_always_inline inline __attribute__((always_inline))
+
+/* Comba's product scanning: column k of the product sums ap[i] * bp[k - i]
+ * in (c2, c1, c0), then c0 is stored and the accumulator shifts down by one
+ * chunk. Every chunk of @rp is written exactly once.
+ */
+static ubn_always_inline void ubn_mul_comba_body(ubn_unit_t *rp,
+                                                 const ubn_unit_t *ap,
+                                                 uint32_t an,
+                                                 const ubn_unit_t *bp,
+                                                 uint32_t bn)
+{
+    ubn_unit_t c0 = 0, c1 = 0, c2 = 0;
+#pragma GCC unroll 16
+    for (uint32_t k = 0; k + 1 < an + bn; k++) {
+        const uint32_t end = MIN(k + 1, an);
+#pragma GCC unroll 8
+        for (uint32_t i = k + 1 > bn ? k + 1 - bn : 0; i < end; i++)
+            ubn_comba_mac(ap[i], bp[k - i], c0, c1, c2);
+        rp[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    rp[an + bn - 1] = c0;
+}
+
+/* Column k of a square holds ap[i] * ap[k - i] twice for i < k - i. These are
+ * summed once, doubled by a shift of the column accumulator and then the
+ * diagonal ap[k / 2] ** 2 is added, so nothing is doubled per row.
+ */
+static ubn_always_inline void ubn_sqr_comba_body(ubn_unit_t *rp,
+                                                 const ubn_unit_t *ap,
+                                                 uint32_t n)
+{
+    ubn_unit_t c0 = 0, c1 = 0, c2 = 0;
+#pragma GCC unroll 16
+    for (uint32_t k = 0; k + 1 < n * 2; k++) {
+        ubn_unit_t t0 = 0, t1 = 0, t2 = 0;
+#pragma GCC unroll 8
+        for (uint32_t i = k + 1 > n ? k + 1 - n : 0; i < k - i; i++)
+            ubn_comba_mac(ap[i], ap[k - i], t0, t1, t2);
+        t2 = t2 << 1 | t1 >> (UBN_UNIT_BIT - 1);
+        t1 = t1 << 1 | t0 >> (UBN_UNIT_BIT - 1);
+        t0 <<= 1;
+        if (!(k & 1))
+            ubn_comba_mac(ap[k / 2], ap[k / 2], t0, t1, t2);
+        int carry = ubn_unit_add(c0, t0, 0, &c0);
+        carry = ubn_unit_add(c1, t1, carry, &c1);
+        c2 += t2 + carry;
+        rp[k] = c0;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    rp[n * 2 - 1] = c0;
+}
+
+static ubn_always_inline ubn_unit_t ubn_add_n_body(ubn_unit_t *rp,
+                                                   const ubn_unit_t *ap,
+                                                   const ubn_unit_t *bp,
+                                                   uint32_t n)
+{
+#if defined(__x86_64__)
+    /* compiled into a plain adc chain */
+    unsigned char carry = 0;
+#pragma GCC unroll 8
+    for (uint32_t i = 0; i < n; i++) {
+        unsigned long long sum;
+        carry = __builtin_ia32_addcarryx_u64(carry, ap[i], bp[i], &sum);
+        rp[i] = sum;
+    }
+#else
+    int carry = 0;
+#pragma GCC unroll 8
+    for (uint32_t i = 0; i < n; i++)
+        carry = ubn_unit_add(ap[i], bp[i], carry, &rp[i]);
+#endif
+    return carry;
+}
+
+void ubn_mul_comba(ubn_unit_t *rp,
+                   const ubn_unit_t *ap,
+                   uint32_t an,
+                   const ubn_unit_t *bp,
+                   uint32_t bn)
+{
+    ubn_mul_comba_body(rp, ap, an, bp, bn);
+}
+
+void ubn_sqr_comba(ubn_unit_t *rp, const ubn_unit_t *ap, uint32_t n)
+{
+    ubn_sqr_comba_body(rp, ap, n);
+}
+
+/* fixed-size kernels for n = 1 ... UBN_FIXED_MAX chunks */
+#define UBN_FIXED(n)                                                    \
+    static void ubn_mul_fixed_##n(ubn_unit_t *rp,                       \
+                                  const ubn_unit_t *ap,                 \
+                                  const ubn_unit_t *bp)                 \
+    {                                                                   \
+        ubn_mul_comba_body(rp, ap, n, bp, n);                           \
+    }                                                                   \
+    static void ubn_sqr_fixed_##n(ubn_unit_t *rp, const ubn_unit_t *ap) \
+    {                                                                   \
+        ubn_sqr_comba_body(rp, ap, n);                                  \
+    }                                                                   \
+    static ubn_unit_t ubn_add_fixed_##n(ubn_unit_t *rp,                 \
+                                        const ubn_unit_t *ap,           \
+                                        const ubn_unit_t *bp)           \
+    {                                                                   \
+        return ubn_add_n_body(rp, ap, bp, n);                           \
+    }
+
+UBN_FIXED(1)
+UBN_FIXED(2)
+UBN_FIXED(3)
+UBN_FIXED(4)
+UBN_FIXED(5)
+UBN_FIXED(6)
+UBN_FIXED(7)
+UBN_FIXED(8)
+
+#define UBN_FIXED_TABLE(op)                                               \
+    {                                                                     \
+        NULL, ubn_##op##_fixed_1, ubn_##op##_fixed_2, ubn_##op##_fixed_3, \
+            ubn_##op##_fixed_4, ubn_##op##_fixed_5, ubn_##op##_fixed_6,   \
+            ubn_##op##_fixed_7, ubn_##op##_fixed_8,                       \
+    }
+
+void (*const ubn_mul_fixed[UBN_FIXED_MAX + 1])(ubn_unit_t *rp,
+                                               const ubn_unit_t *ap,
+                                               const ubn_unit_t *bp) =
+    UBN_FIXED_TABLE(mul);
+void (*const ubn_sqr_fixed[UBN_FIXED_MAX + 1])(ubn_unit_t *rp,
+                                               const ubn_unit_t *ap) =
+    UBN_FIXED_TABLE(sqr);
+ubn_unit_t (*const ubn_add_fixed[UBN_FIXED_MAX + 1])(ubn_unit_t *rp,
+                                                     const ubn_unit_t *ap,
+                                                     const ubn_unit_t *bp) =
+    UBN_FIXED_TABLE(add);
+
+ubn_limb_ops_t ubn_limb_ops = {
+    .name = "generic",
+    .mul_1 = ubn_mul_1_generic,
+    .addmul_1 = ubn_addmul_1_generic,
+    .add_n = ubn_add_n_generic,
+    .sub_n = ubn_sub_n_generic,
+};
+
+#if defined(__x86_64__)
+/* The loops below walk a negative index in %rcx up to 0. Both lea and jrcxz
+ * leave the flags alone, so the carry chains survive across iterations.
+ */
+
+static ubn_unit_t ubn_mul_1_mulx(ubn_unit_t *rp,
+                                 const ubn_unit_t *ap,
+                                 uint32_t n,
+                                 ubn_unit_t b)
+{
+    ubn_unit_t overlap = 0, low, high;
+    long i = -(long) n;
+    if (unlikely(!n))
+        return 0;
+    __asm__ volatile(
+        "xor %k[low], %k[low]\n\t"  // clear CF
+        "1:\n\t"
+        "mulx (%[ap], %[i], 8), %[low], %[high]\n\t"
+        "adcx %[ov], %[low]\n\t"
+        "mov %[low], (%[rp], %[i], 8)\n\t"
+        "mov %[high], %[ov]\n\t"
+        "lea 1(%[i]), %[i]\n\t"
+        "jrcxz 2f\n\t"
+        "jmp 1b\n\t"
+        "2:\n\t"
+        "mov $0, %k[low]\n\t"
+        "adcx %[low], %[ov]\n\t"
+        : [ov] "+&r"(overlap), [low] "=&r"(low), [high] "=&r"(high),
+          [i] "+&c"(i)
+        : [ap] "r"(ap + n), [rp] "r"(rp + n), "d"(b)
+        : "cc", "memory");
+    return overlap;
+}
+
+/* Two independent carry chains: CF adds the high part of the previous
+ * product to the low part of this one, and OF adds the result to rp[i].
+ */
+static ubn_unit_t ubn_addmul_1_adx(ubn_unit_t *rp,
+                                   const ubn_unit_t *ap,
+                                   uint32_t n,
+                                   ubn_unit_t b)
+{
+    ubn_unit_t overlap = 0, low, high;
+    long i = -(long) n;
+    if (unlikely(!n))
+        return 0;
+    __asm__ volatile(
+        "xor %k[low], %k[low]\n\t"  // clear CF and OF
+        "1:\n\t"
+        "mulx (%[ap], %[i], 8), %[low], %[high]\n\t"
+        "adcx %[ov], %[low]\n\t"
+        "adox (%[rp], %[i], 8), %[low]\n\t"
+        "mov %[low], (%[rp], %[i], 8)\n\t"
+        "mov %[high], %[ov]\n\t"
+        "lea 1(%[i]), %[i]\n\t"
+        "jrcxz 2f\n\t"
+        "jmp 1b\n\t"
+        "2:\n\t"
+        "mov $0, %k[low]\n\t"
+        "adcx %[low], %[ov]\n\t"
+        "adox %[low], %[ov]\n\t"  // no carry-out would be generated
+        : [ov] "+&r"(overlap), [low] "=&r"(low), [high] "=&r"(high),
+          [i] "+&c"(i)
+        : [ap] "r"(ap + n), [rp] "r"(rp + n), "d"(b)
+        : "cc", "memory");
+    return overlap;
+}
+
+static ubn_unit_t ubn_add_n_adc(ubn_unit_t *rp,
+                                const ubn_unit_t *ap,
+                                const ubn_unit_t *bp,
+                                uint32_t n)
+{
+    ubn_unit_t tmp;
+    long i = -(long) n;
+    if (unlikely(!n))
+        return 0;
+    __asm__ volatile(
+        "xor %k[tmp], %k[tmp]\n\t"  // clear CF
+        "1:\n\t"
+        "mov (%[ap], %[i], 8), %[tmp]\n\t"
+        "adc (%[bp], %[i], 8), %[tmp]\n\t"
+        "mov %[tmp], (%[rp], %[i], 8)\n\t"
+        "lea 1(%[i]), %[i]\n\t"
+        "jrcxz 2f\n\t"
+        "jmp 1b\n\t"
+        "2:\n\t"
+        "mov $0, %k[tmp]\n\t"
+        "adc $0, %[tmp]\n\t"
+        : [tmp] "=&r"(tmp), [i] "+&c"(i)
+        : [ap] "r"(ap + n), [bp] "r"(bp + n), [rp] "r"(rp + n)
+        : "cc", "memory");
+    return tmp;
+}
+
+static ubn_unit_t ubn_sub_n_sbb(ubn_unit_t *rp,
+                                const ubn_unit_t *ap,
+                                const ubn_unit_t *bp,
+                                uint32_t n)
+{
+    ubn_unit_t tmp;
+    long i = -(long) n;
+    if (unlikely(!n))
+        return 0;
+    __asm__ volatile(
+        "xor %k[tmp], %k[tmp]\n\t"  // clear CF
+        "1:\n\t"
+        "mov (%[ap], %[i], 8), %[tmp]\n\t"
+        "sbb (%[bp], %[i], 8), %[tmp]\n\t"
+        "mov %[tmp], (%[rp], %[i], 8)\n\t"
+        "lea 1(%[i]), %[i]\n\t"
+        "jrcxz 2f\n\t"
+        "jmp 1b\n\t"
+        "2:\n\t"
+        "mov $0, %k[tmp]\n\t"
+        "adc $0, %[tmp]\n\t"
+        : [tmp] "=&r"(tmp), [i] "+&c"(i)
+        : [ap] "r"(ap + n), [bp] "r"(bp + n), [rp] "r"(rp + n)
+        : "cc", "memory");
+    return tmp;
+}
+
+static bool ubn_cpu_has_adx(void)
+{
+#if KSPACE
+    return boot_cpu_has(X86_FEATURE_BMI2) && boot_cpu_has(X86_FEATURE_ADX);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ebx & bit_BMI2) && (ebx & bit_ADX);
+#endif
+}
+#endif
+
+uint32_t ubn_comba_max = UBN_COMBA_MAX;
+
+/* ubn_limb_tune() looks for the end of the column products up to here */
+#define UBN_COMBA_TUNE_MAX 64
+/* products per timing, a single one is too short for the clock */
+#define UBN_COMBA_TUNE_REPS 16
+
+/* the best of a few runs of UBN_COMBA_TUNE_REPS products of two @n-chunk
+ * numbers in ns
+ */
+static uint64_t ubn_comba_time(ubn_unit_t *buf, uint32_t n, bool comba)
+{
+    uint64_t best = ~(uint64_t) 0;
+    for (int r = 0; r < 5; r++) {
+        uint64_t t = ubn_clock();
+        for (int i = 0; i < UBN_COMBA_TUNE_REPS; i++) {
+            if (comba)
+                ubn_mul_comba(buf + 2 * n, buf, n, buf + n, n);
+            else
+                ubn_mul_basecase(buf + 2 * n, buf, n, buf + n, n);
+        }
+        t = ubn_clock() - t;
+        best = MIN(best, t);
+    }
+    return best;
+}
+
+/* Time the column and the row products of the sizes beyond the unrolled
+ * kernels, ubn_comba_max becomes the last size where the columns win. The
+ * vectorized basecase is calibrated against the rows afterwards.
+ * The kernels in use must not change meanwhile.
+ */
+void ubn_limb_tune(void)
+{
+    ubn_unit_t *buf = MALLOC(sizeof(ubn_unit_t) * UBN_COMBA_TUNE_MAX * 4);
+    if (buf) {
+        uint32_t comba_max = UBN_FIXED_MAX;
+        uint64_t x = 0x9E3779B97F4A7C15u;
+        for (uint32_t i = 0; i < UBN_COMBA_TUNE_MAX * 2; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[i] = (ubn_unit_t) x;
+        }
+        for (uint32_t n = UBN_FIXED_MAX + 1; n <= UBN_COMBA_TUNE_MAX; n++) {
+            if (ubn_comba_time(buf, n, true) > ubn_comba_time(buf, n, false))
+                break;
+            comba_max = n;
+        }
+        FREE(buf);
+        ubn_comba_max = comba_max;
+    }
+    ubn_simd_tune();
+}
+
+/* pick the kernels for the running CPU and time the products built on them */
+void ubn_limb_init(void)
+{
+#if defined(__x86_64__)
+    if (ubn_cpu_has_adx()) {
+        ubn_limb_ops.name = "mulx-adx";
+        ubn_limb_ops.mul_1 = ubn_mul_1_mulx;
+        ubn_limb_ops.addmul_1 = ubn_addmul_1_adx;
+        ubn_limb_ops.add_n = ubn_add_n_adc;
+        ubn_limb_ops.sub_n = ubn_sub_n_sbb;
+    }
+#endif
+    ubn_simd_init();
+    ubn_limb_tune();
+}
+
+void ubn_limb_exit(void)
+{
+    ubn_simd_exit();
+}
@@ -0,0 +1,139 @@
+#ifndef __UBN_LIMB_H
+#define __UBN_LIMB_H
+
+#include "base.h"
+
+#if KSPACE
+#include <linux/ktime.h>
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#include <time.h>
+#endif
+
+/* Kernels working on raw chunk arrays, LS:[0]
+ * mul_1:    rp[0 : n] = ap[0 : n] * b, return the carry-out chunk
+ * addmul_1: rp[0 : n] += ap[0 : n] * b, return the carry-out chunk
+ * add_n:    rp[0 : n] = ap[0 : n] + bp[0 : n], return the carry-out bit
+ * sub_n:    rp[0 : n] = ap[0 : n] - bp[0 : n], return the borrow bit
+ * @rp may be exactly @ap or @bp, other overlaps are not allowed.
+ */
+typedef struct {
+    const char *name;
+    ubn_unit_t (*mul_1)(ubn_unit_t *rp,
+                        const ubn_unit_t *ap,
+                        uint32_t n,
+                        ubn_unit_t b);
+    ubn_unit_t (*addmul_1)(ubn_unit_t *rp,
+                           const ubn_unit_t *ap,
+                           uint32_t n,
+                           ubn_unit_t b);
+    ubn_unit_t (*add_n)(ubn_unit_t *rp,
+                        const ubn_unit_t *ap,
+                        const ubn_unit_t *bp,
+                        uint32_t n);
+    ubn_unit_t (*sub_n)(ubn_unit_t *rp,
+                        const ubn_unit_t *ap,
+                        const ubn_unit_t *bp,
+                        uint32_t n);
+} ubn_limb_ops_t;
+
+/* the kernels in use, generic until ubn_limb_init() finds something better */
+extern ubn_limb_ops_t ubn_limb_ops;
+
+void ubn_limb_init(void);
+void ubn_limb_exit(void);
+void ubn_limb_tune(void);
+
+/* Products whose operands are both at most ubn_comba_max chunks are computed
+ * column by column, longer ones row by row with the kernels above.
+ * UBN_COMBA_MAX is used until ubn_limb_tune() has timed both on this machine.
+ */
+#define UBN_COMBA_MAX 16
+extern uint32_t ubn_comba_max;
+
+/* rp[0 : an + bn] = ap[0 : an] * bp[0 : bn]
+ * rp[0 : 2n] = ap[0 : n] ** 2
+ * @rp must not overlap the operands and the sizes must not be 0.
+ */
+void ubn_mul_comba(ubn_unit_t *rp,
+                   const ubn_unit_t *ap,
+                   uint32_t an,
+                   const ubn_unit_t *bp,
+                   uint32_t bn);
+void ubn_sqr_comba(ubn_unit_t *rp, const ubn_unit_t *ap, uint32_t n);
+
+/* Fully unrolled kernels for operands of exactly n chunks, indexed by n for
+ * 1 <= n <= UBN_FIXED_MAX. They behave as the ones above with an = bn = n.
+ */
+#define UBN_FIXED_MAX 8
+
+extern void (*const ubn_mul_fixed[UBN_FIXED_MAX + 1])(ubn_unit_t *rp,
+                                                      const ubn_unit_t *ap,
+                                                      const ubn_unit_t *bp);
+extern void (*const ubn_sqr_fixed[UBN_FIXED_MAX + 1])(ubn_unit_t *rp,
+                                                      const ubn_unit_t *ap);
+extern ubn_unit_t (*const ubn_add_fixed[UBN_FIXED_MAX + 1])(
+    ubn_unit_t *rp,
+    const ubn_unit_t *ap,
+    const ubn_unit_t *bp);
+
+static inline ubn_unit_t ubn_mul_1(ubn_unit_t *rp,
+                                   const ubn_unit_t *ap,
+                                   uint32_t n,
+                                   ubn_unit_t b)
+{
+    return ubn_limb_ops.mul_1(rp, ap, n, b);
+}
+
+static inline ubn_unit_t ubn_addmul_1(ubn_unit_t *rp,
+                                      const ubn_unit_t *ap,
+                                      uint32_t n,
+                                      ubn_unit_t b)
+{
+    return ubn_limb_ops.addmul_1(rp, ap, n, b);
+}
+
+static inline ubn_unit_t ubn_add_n(ubn_unit_t *rp,
+                                   const ubn_unit_t *ap,
+                                   const ubn_unit_t *bp,
+                                   uint32_t n)
+{
+    return ubn_limb_ops.add_n(rp, ap, bp, n);
+}
+
+static inline ubn_unit_t ubn_sub_n(ubn_unit_t *rp,
+                                   const ubn_unit_t *ap,
+                                   const ubn_unit_t *bp,
+                                   uint32_t n)
+{
+    return ubn_limb_ops.sub_n(rp, ap, bp, n);
+}
+
+/* rp[0 : an + bn] = ap[0 : an] * bp[0 : bn], row by row
+ * @rp must not overlap the operands and @bn must not be 0.
+ */
+static inline void ubn_mul_basecase(ubn_unit_t *rp,
+                                    const ubn_unit_t *ap,
+                                    uint32_t an,
+                                    const ubn_unit_t *bp,
+                                    uint32_t bn)
+{
+    rp[an] = ubn_mul_1(rp, ap, an, bp[0]);
+    for (uint32_t i = 1; i < bn; i++)
+        rp[i + an] = ubn_addmul_1(rp + i, ap, an, bp[i]);
+}
+
+/* monotonic time in ns, for the tuning */
+static inline uint64_t ubn_clock(void)
+{
+#if KSPACE
+    return ktime_get_ns();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+#endif
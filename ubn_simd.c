@@ -0,0 +1,272 @@
+#include "ubn_simd.h"
+#include "base.h"
+#include "ubignum.h"
+#include "ubn_limb.h"
+
+#if KSPACE
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#if defined(__x86_64__)
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/* products of at least this many chunks on both sides go to the vectorized
+ * basecase, 0 means never
+ */
+uint32_t ubn_simd_threshold = 0;
+
+#if defined(__x86_64__) && CPU64
+
+/* AVX-512 IFMA basecase
+ * The operands are split into 52-bit digits, one per 64-bit lane.
+ * vpmadd52luq/vpmadd52huq add the low/high 52 bits of 8 digit products to 8
+ * accumulators at once. Each output block of 8 digits is accumulated in
+ * registers over all the rows and stored once, so the sum of a lane grows
+ * by less than 2 ** 53 per row, which bounds the operands to
+ * UBN_SIMD_MAX_DIGITS digits.
+ */
+#define UBN_SIMD_TARGET __attribute__((target("avx512f,avx512ifma")))
+#define DIGIT_BIT 52
+#define DIGIT_MASK ((((uint64_t) 1) << DIGIT_BIT) - 1)
+#define PAD 8  // zero digits around @b for the unaligned loads
+/* digits of @a, padded digits of @b and the column sums */
+#define SCRATCH_SIZE (4 * UBN_SIMD_MAX_DIGITS + 3 * PAD)
+
+typedef long long v8di __attribute__((vector_size(64)));
+typedef long long v8di_u __attribute__((vector_size(64), aligned(8)));
+
+#if KSPACE
+static DEFINE_PER_CPU(uint64_t *, ubn_simd_scratch);
+#else
+static __thread uint64_t ubn_simd_scratch[SCRATCH_SIZE];
+#endif
+
+static bool ubn_simd_capable;
+
+/* split @n chunks into 52-bit digits, return the number of digits */
+static uint32_t ubn_to_digits(uint64_t *d, const ubn_unit_t *a, uint32_t n)
+{
+    ubn_extunit_t acc = 0;
+    uint32_t bits = 0, nd = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        acc |= (ubn_extunit_t) a[i] << bits;
+        bits += UBN_UNIT_BIT;
+        while (bits >= DIGIT_BIT) {
+            d[nd++] = (uint64_t) acc & DIGIT_MASK;
+            acc >>= DIGIT_BIT;
+            bits -= DIGIT_BIT;
+        }
+    }
+    if (bits)
+        d[nd++] = (uint64_t) acc;
+    return nd;
+}
+
+/* rp[0 : n] = the normalized value of the column sums */
+static void ubn_from_columns(ubn_unit_t *rp,
+                             uint32_t n,
+                             const uint64_t *col,
+                             uint32_t ncol)
+{
+    ubn_extunit_t acc = 0;
+    uint64_t carry = 0;
+    uint32_t bits = 0, ri = 0;
+    for (uint32_t j = 0; j < ncol && ri < n; j++) {
+        const uint64_t v = col[j] + carry;
+        carry = v >> DIGIT_BIT;
+        acc |= (ubn_extunit_t)(v & DIGIT_MASK) << bits;
+        bits += DIGIT_BIT;
+        if (bits >= UBN_UNIT_BIT) {
+            rp[ri++] = (ubn_unit_t) acc;
+            acc >>= UBN_UNIT_BIT;
+            bits -= UBN_UNIT_BIT;
+        }
+    }
+    if (ri < n)
+        rp[ri++] = (ubn_unit_t) acc;
+    while (ri < n)
+        rp[ri++] = 0;
+}
+
+UBN_SIMD_TARGET static void ubn_ifma_columns(uint64_t *col,
+                                             const uint64_t *da,
+                                             uint32_t na,
+                                             const uint64_t *db,
+                                             uint32_t nb)
+{
+    const v8di zero = {0};
+    for (uint32_t c = 0; c < na + nb; c += 8) {
+        v8di lo = zero, hi = zero;
+        /* rows whose products reach digits [c, c + 8) */
+        const uint32_t i0 = c > nb ? c - nb : 0;
+        const uint32_t i1 = MIN(na, c + 8);
+        for (uint32_t i = i0; i < i1; i++) {
+            const v8di x = zero + (long long) da[i];
+            const v8di y = *(const v8di_u *) (db + c - i);
+            const v8di z = *(const v8di_u *) (db + c - i - 1);
+            lo = __builtin_ia32_vpmadd52luq512_mask(lo, x, y, 0xFF);
+            hi = __builtin_ia32_vpmadd52huq512_mask(hi, x, z, 0xFF);
+        }
+        *(v8di_u *) (col + c) = lo + hi;
+    }
+}
+
+/* rp[0 : an + bn] = ap[0 : an] * bp[0 : bn]
+ * Return false if the vectorized basecase can't be used here.
+ */
+bool ubn_simd_mult(ubn_unit_t *rp,
+                   const ubn_unit_t *ap,
+                   uint32_t an,
+                   const ubn_unit_t *bp,
+                   uint32_t bn)
+{
+    if (!ubn_simd_capable || (uint64_t) MAX(an, bn) * UBN_UNIT_BIT >
+                                 (uint64_t) UBN_SIMD_MAX_DIGITS * DIGIT_BIT)
+        return false;
+#if KSPACE
+    if (!irq_fpu_usable())
+        return false;
+    kernel_fpu_begin();
+    uint64_t *const scratch = this_cpu_read(ubn_simd_scratch);
+#else
+    uint64_t *const scratch = ubn_simd_scratch;
+#endif
+    uint64_t *const da = scratch;
+    uint64_t *const db = da + UBN_SIMD_MAX_DIGITS + PAD;
+    uint64_t *const col = db + UBN_SIMD_MAX_DIGITS + PAD;
+
+    const uint32_t na = ubn_to_digits(da, ap, an);
+    memset(db - PAD, 0, sizeof(uint64_t) * PAD);
+    const uint32_t nb = ubn_to_digits(db, bp, bn);
+    memset(db + nb, 0, sizeof(uint64_t) * PAD);
+    ubn_ifma_columns(col, da, na, db, nb);
+    ubn_from_columns(rp, an + bn, col, na + nb);
+#if KSPACE
+    kernel_fpu_end();
+#endif
+    return true;
+}
+
+static bool ubn_cpu_has_ifma(void)
+{
+#if KSPACE
+    return boot_cpu_has(X86_FEATURE_AVX512F) &&
+           boot_cpu_has(X86_FEATURE_AVX512IFMA) &&
+           cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM |
+                                 XFEATURE_MASK_AVX512,
+                             NULL);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512ifma");
+#endif
+}
+
+/* the best of a few runs of a product of two @n-chunk numbers in ns */
+static uint64_t ubn_simd_time(ubn_unit_t *buf, uint32_t n, bool simd)
+{
+    uint64_t best = ~(uint64_t) 0;
+    for (int r = 0; r < 5; r++) {
+        uint64_t t = ubn_clock();
+        if (simd)
+            ubn_simd_mult(buf + 2 * n, buf, n, buf + n, n);
+        else
+            ubn_mul_basecase(buf + 2 * n, buf, n, buf + n, n);
+        t = ubn_clock() - t;
+        best = MIN(best, t);
+    }
+    return best;
+}
+
+/* detect IFMA, ubn_simd_tune() then decides whether it is worth it */
+void ubn_simd_init(void)
+{
+    ubn_simd_threshold = 0;
+    if (!ubn_cpu_has_ifma())
+        return;
+#if KSPACE
+    int cpu;
+    for_each_possible_cpu (cpu) {
+        uint64_t *p = kmalloc_node(sizeof(uint64_t) * SCRATCH_SIZE,
+                                   GFP_KERNEL, cpu_to_node(cpu));
+        if (!p) {
+            ubn_simd_exit();
+            return;
+        }
+        per_cpu(ubn_simd_scratch, cpu) = p;
+    }
+#endif
+    ubn_simd_capable = true;
+}
+
+/* Find the size from which the vectorized basecase beats ubn_mul_basecase()
+ * with the chosen limb kernels on this machine.
+ * The threshold becomes 0 if it never does.
+ */
+void ubn_simd_tune(void)
+{
+    const uint32_t max_n = UBN_SIMD_MAX_DIGITS * DIGIT_BIT / UBN_UNIT_BIT;
+    uint32_t threshold = 0;
+    if (!ubn_simd_capable)
+        return;
+    ubn_unit_t *buf = MALLOC(sizeof(ubn_unit_t) * max_n * 4);
+    if (!buf)
+        return;
+    uint64_t x = 0x9E3779B97F4A7C15u;
+    for (uint32_t i = 0; i < max_n * 2; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = x;
+    }
+    /* walk down from the largest size while the vectorized one still wins */
+    for (uint32_t n = max_n; n >= 4; n /= 2) {
+        if (ubn_simd_time(buf, n, true) >= ubn_simd_time(buf, n, false))
+            break;
+        threshold = n;
+    }
+    FREE(buf);
+    ubn_simd_threshold = threshold;
+}
+
+void ubn_simd_exit(void)
+{
+    ubn_simd_capable = false;
+    ubn_simd_threshold = 0;
+#if KSPACE
+    int cpu;
+    for_each_possible_cpu (cpu) {
+        kfree(per_cpu(ubn_simd_scratch, cpu));
+        per_cpu(ubn_simd_scratch, cpu) = NULL;
+    }
+#endif
+}
+
+#else
+
+bool ubn_simd_mult(ubn_unit_t *rp,
+                   const ubn_unit_t *ap,
+                   uint32_t an,
+                   const ubn_unit_t *bp,
+                   uint32_t bn)
+{
+    return false;
+}
+
+void ubn_simd_init(void) {}
+
+void ubn_simd_tune(void) {}
+
+void ubn_simd_exit(void) {}
+
+#endif
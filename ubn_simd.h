@@ -0,0 +1,34 @@
+#ifndef __UBN_SIMD_H
+#define __UBN_SIMD_H
+
+#include "base.h"
+
+#if KSPACE
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+/* operands are limited to this many 52-bit digits, i.e. 832 64-bit chunks */
+#define UBN_SIMD_MAX_DIGITS 1024
+
+extern uint32_t ubn_simd_threshold;
+
+bool ubn_simd_mult(ubn_unit_t *rp,
+                   const ubn_unit_t *ap,
+                   uint32_t an,
+                   const ubn_unit_t *bp,
+                   uint32_t bn);
+void ubn_simd_init(void);
+void ubn_simd_tune(void);
+void ubn_simd_exit(void);
+
+/* whether a product of @an and @bn chunks should try ubn_simd_mult() */
+static inline bool ubn_simd_wanted(uint32_t an, uint32_t bn)
+{
+    const uint32_t t = ubn_simd_threshold;
+    return t && an >= t && bn >= t;
+}
+
+#endif